@@ -6,82 +6,183 @@ extern Count debug_level;
 void
 BiLexicon::check_invariant() const {
 #ifndef NDEBUG
-  Parent::check_invariant();
   _tables.check_invariant();
   Count total_tables = 0;
   Count total_tokens = 0;
-  cforeach(BiLexicon, i, *this) {
-    _restaurants.find(i->first) !=_restaurants.end();
-  }
+  Count ntypes = 0;
+  Count nsuccessors = 0;
   cforeach(Restaurants, i, _restaurants) {
-    find(i->first) != end();
+    Bigram b = Bigram::from_key(i->first);
+    my_assert(i->second.ntokens() > 0, b);
     i->second.check_invariant();
     total_tables += i->second.ntables();
     total_tokens += i->second.ntokens();
+    ntypes++;
+    const vector<WordId>& next = successors(b.first);
+    my_assert(std::find(next.begin(), next.end(), b.second) != next.end(), b);
+  }
+  cforeach(Successors, i, _successors) {
+    my_assert(!i->second.empty(), i->first);
+    nsuccessors += i->second.size();
   }
+  my_assert(ntypes == _restaurants.size(), CC(ntypes, _restaurants.size()));
+  my_assert(nsuccessors == ntypes, CC(nsuccessors, ntypes));
   assert(total_tables == ntables());
   assert(total_tokens == ntokens());
+  Float log_p = compute_log_seating();
+  my_assert(fabs(_log_seating - log_p) <= 1e-6*(1 + log_p),
+	    FF(_log_seating, log_p));
+  log_p = compute_log_labels();
+  my_assert(fabs(_log_labels - log_p) <= 1e-6*(1 + fabs(log_p)),
+	    FF(_log_labels, log_p));
 #endif
 }
 
-// add bigram to random table and return index of table
+Float
+BiLexicon::compute_log_seating() const {
+  Float log_p = 0;
+  cforeach(Restaurants, i, _restaurants)
+    log_p += i->second.log_seating();
+  return log_p;
+}
+
+Float
+BiLexicon::compute_log_labels() const {
+  Float log_p = 0;
+  cforeach(Tables, t, _tables) {
+    Float a = State::p_word(t->first);
+    log_p += lgamma(t->second + a) - lgamma(a);
+  }
+  return log_p;
+}
+
+// the restaurants are saved slot by slot, so that they come back
+// in the same places (and are summed in the same order).
+void
+BiLexicon::save(Checkpoint& c) const {
+  const vector<Restaurants::Slot>& slots = _restaurants.slots();
+  c.put((uint64_t)slots.size());
+  cforeach(vector<Restaurants::Slot>, s, slots) {
+    c.put(s->first);
+    if (s->full())
+      s->second.save(c);
+  }
+  c.put(_ntokens);
+  _tables.save(c);
+  c.put((uint64_t)_successors.size());
+  cforeach(Successors, i, _successors) {
+    c.put(i->first);
+    c.put(i->second);
+  }
+  c.put(_log_seating);
+  c.put(_log_labels);
+}
+
+void
+BiLexicon::restore(Checkpoint& c) {
+  clear();
+  uint64_t n;
+  c.get(n);
+  vector<Restaurants::Slot> slots(n);
+  foreach(vector<Restaurants::Slot>, s, slots) {
+    c.get(s->first);
+    if (s->full())
+      s->second.restore(c);
+  }
+  _restaurants.assign(slots);
+  c.get(_ntokens);
+  _tables.restore(c);
+  c.get(n);
+  for (uint64_t k = 0; k < n; k++) {
+    WordId w;
+    c.get(w);
+    c.get(_successors[w]);
+  }
+  c.get(_log_seating);
+  c.get(_log_labels);
+}
+
+// add bigram to random table and return the number of tokens
+// that were at the table (0 if it is a new table)
 size_t 
 BiLexicon::inc(const Bigram& pair, Float temp) {
-  Count index = 0;
-  Restaurants::iterator i = _restaurants.find(pair);
-  if (i != _restaurants.end()) {
-    index = i->second.sample_table(temp);
+  std::pair<Restaurants::iterator, bool> i = _restaurants.insert(pair.key());
+  Restaurant& r = i.first->second;
+  Count k = 0;
+  if (!i.second) {
+    bool timed = Profile::timing();
+    Profile::Step step = timed ? Profile::step(Profile::TABLES) : Profile::ADD;
+    k = r.sample_table(State::p_word(pair, *this), temp);
+    if (timed) Profile::step(step);
   }
-  place(pair, index);
-  return index;
+  seat(pair, r, k);
+  return k;
 }
 
-// remove bigram from random table and return index of table
+// remove bigram from the table of a random token of it and return
+// the number of tokens that were at that table
 size_t 
-BiLexicon::dec(const Bigram& pair, Float temp) {
-  Restaurants::iterator i = _restaurants.find(pair);
+BiLexicon::dec(const Bigram& pair) {
+  Restaurants::iterator i = _restaurants.find(pair.key());
   my_assert(i != _restaurants.end(), pair);
-  Count index = i->second.sample_table(temp);
-  remove(pair, index);
-  return index;
+  Count k = i->second.sample_token();
+  remove(pair, k);
+  return k;
 }
 
-//if "unsafe", doesn't do most assertion checks even when debugging
-//mode is on. this is needed for computing log posterior, b/c
-//tables must be incremented out of order.
-bool 
-BiLexicon::place(const Bigram& b, Count table, bool unsafe) {
-  debug_output(900, "BiLexicon::place(): (bg, table) = ", BiC(b,table));
-  Restaurants::iterator i;
-  if (Parent::inc(b)) {
-    i = _restaurants.insert(Restaurant_pair(b, Restaurant(b))).first;
-  }
-  else {
-    i = _restaurants.find(b);
+bool
+BiLexicon::seat(const Bigram& b, Restaurant& r, Count k) {
+  debug_output(900, "BiLexicon::place(): (bg, table size) = ", BiC(b,k));
+  if (r.ntokens() == 0) {
+    Profile::count(Profile::RESTAURANTS_CREATED);
+    _successors[b.first].push_back(b.second);
   }
+  _ntokens++;
   bool added_table = false;
-  if (i->second.inc_table(table, unsafe)) {
+  if (r.inc_table(k)) {
+    _log_labels += log(_tables(b.second) + State::p_word(b.second));
     _tables.inc(b.second);
     added_table = true;
   }
-  if (!unsafe) 
-    check_invariant();
+  else
+    _log_seating += log(k);
+  r.check_invariant();
   return added_table;
 }
 
 bool 
-BiLexicon::remove(const Bigram& b, Count table) {
-  debug_output(900, "BiLexicon::remove(): (bg, table) = ", BiC(b,table));
-  Parent::dec(b);
-  Restaurants::iterator i;
-  i = _restaurants.find(b);
+BiLexicon::remove(const Bigram& b, Count k) {
+  debug_output(900, "BiLexicon::remove(): (bg, table size) = ", BiC(b,k));
+  Restaurants::iterator i = _restaurants.find(b.key());
   my_assert(i != _restaurants.end(), b);
+  Restaurant* r = &i->second;
+  _ntokens--;
   bool removed_table = false;
-  if (i->second.dec_table(table)) {
+  if (r->dec_table(k)) {
     _tables.dec(b.second);
+    _log_labels -= log(_tables(b.second) + State::p_word(b.second));
     removed_table = true;
   }
-  check_invariant();
+  else
+    _log_seating -= log(k - 1);
+  r->check_invariant();
+  if (r->ntokens() == 0) {
+    _restaurants.erase(i);
+    Successors::iterator j = _successors.find(b.first);
+    my_assert(j != _successors.end(), b);
+    vector<WordId>& next = j->second;
+    *std::find(next.begin(), next.end(), b.second) = next.back();
+    next.pop_back();
+    if (next.empty())
+      _successors.erase(j);
+  }
   return removed_table;
 }
 
+void
+BiLexicon::print(ostream& os) const {
+  os << "Restaurants: " << endl;
+  cforeach(Restaurants, i, _restaurants)
+    os << Bigram::from_key(i->first) << " " << i->second << endl;
+  os << "Tables: " << endl <<  _tables << endl;
+}
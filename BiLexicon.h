@@ -6,71 +6,119 @@
 #include "typedefs.h"
 #include "NGrams.h"
 #include "Restaurant.h"
+#include "FlatMap.h"
+#include "Profile.h"
 
 /*
 The bigram lexicon keeps track of bigrams, and also
 estimates the number of tables on which each word
-sits.
+sits.  As tables fill and empty it keeps two running
+sums for the log joint: the seating term (log (k-1)!
+for each table with k tokens) and the labels term (log
+Gamma(t_w + alpha*P0(w))/Gamma(alpha*P0(w)) for each
+word on t_w tables).  It also keeps, for each word, the
+list of words that follow it, so that the bigrams with a
+given first word can be found without a scan.
+
+Each bigram's Restaurant (which also holds its count) is
+stored inline in a FlatMap keyed by the packed pair of
+word ids, so seating or unseating a token finds
+everything it needs with one probe.
 */
 
-class BiLexicon: public SGLexiconBase<Bigram, Count> {
+class BiLexicon {
 private:
-  typedef SGLexiconBase<Bigram, Count> Parent;
   typedef pair<Bigram, Count> BiC;
 public:
-  BiLexicon(const State* state) {Restaurant::STATE = state;}
-  BiLexicon() {}
-  virtual ~BiLexicon() {}
-  virtual void check_invariant() const;
-  virtual void clear() {
-    Parent::clear();
+  BiLexicon(): _ntokens(0), _log_seating(0), _log_labels(0) {}
+  void check_invariant() const;
+  void clear() {
+    _restaurants.clear();
+    _ntokens = 0;
     _tables.clear();
+    _successors.clear();
+    _log_seating = 0;
+    _log_labels = 0;
+  }
+  // number of tokens of b
+  Count operator()(const Bigram& b) const {
+    Profile::count(Profile::LOOKUPS);
+    Restaurants::const_iterator i = _restaurants.find(b.key());
+    return i == _restaurants.end() ? 0 : i->second.ntokens();
   }
-  // adds to a random table
-  //returns table number
-  virtual size_t inc(const Bigram& pair) {return inc(pair, 1);}
-  virtual size_t dec(const Bigram& pair) {return dec(pair, 1);}
-  virtual size_t inc(const Bigram& pair, Float temp);
-  virtual size_t dec(const Bigram& pair, Float temp);
-  // adds one token of s to specified table
+  // adds to a random table (removes from the table of a random token)
+  // returns the number of tokens at the table before
+  size_t inc(const Bigram& pair) {return inc(pair, 1);}
+  size_t inc(const Bigram& pair, Float temp);
+  size_t dec(const Bigram& pair);
+  // adds one token of b to a table with k tokens (k = 0 for a new table)
   // returns true if a new table was created.
-  // set unsafe->true only in log posterior when tables may be incr'd out of order.
-  bool place(const Bigram& b, Count table, bool unsafe=false);
-  // removes one token from specified table
+  bool place(const Bigram& b, Count k) {
+    return seat(b, _restaurants.insert(b.key()).first->second, k);
+  }
+  // removes one token of b from a table with k tokens
   // returns true if table was deleted
-  bool remove(const Bigram& b, Count table);
-  virtual Count ntables(const string& s) const {
-    return _tables(s);
+  bool remove(const Bigram& b, Count k);
+  Count ntables(WordId w) const {
+    return _tables(w);
   }
-  virtual Count ntables() const {
+  Count ntables() const {
     return _tables.ntokens();
   }
-  virtual Count ntokens() const {
-    return Parent::ntokens();
+  Count ntokens() const {
+    return _ntokens;
   }
-  virtual Count ntokens(const Bigram& b, Count table) const {
-    Restaurants::const_iterator i = _restaurants.find(b);
-    if (i == _restaurants.end()) return 0;
-    return i->second.ntokens(table);
+  size_t ntypes() const {
+    return _restaurants.size();
   }
-  void print(ostream& os=cout) {
-    os << "Restaurants: " << endl;
-    cforeach (Restaurants, r,_restaurants) {
-      os << r->second << endl;
-    }
-    os << "Tables: " << endl <<  _tables << endl;
+  // the words w with (previous, w) in the lexicon, in no
+  // particular order.
+  const vector<WordId>& successors(WordId previous) const {
+    static const vector<WordId> none;
+    Successors::const_iterator i = _successors.find(previous);
+    return i == _successors.end() ? none : i->second;
   }
+  // the words on at least one table, with their number of tables.
+  typedef SGLexicon<WordId, Count> Tables;
+  const Tables& tables() const {return _tables;}
+  // sum of Restaurant::log_seating() over all bigrams.
+  Float log_seating() const {return _log_seating;}
+  // sum over words w of log Gamma(t_w + alpha*P0(w))/Gamma(alpha*P0(w)).
+  Float log_labels() const {return _log_labels;}
+  // the same two, from scratch.
+  Float compute_log_seating() const;
+  Float compute_log_labels() const;
+  // call whenever P0 changes.
+  void reset_log_labels() {_log_labels = compute_log_labels();}
+  // see Restaurant::fill_size().
+  Count fill_size(const Bigram& b, Count m) const {
+    Restaurants::const_iterator i = _restaurants.find(b.key());
+    return i == _restaurants.end() ? 0 : i->second.fill_size(m);
+  }
+  // bytes used by the bigram table (not counting the few
+  // restaurants with a dense histogram).
+  size_t memory() const {return _restaurants.memory();}
+  void print(ostream& os=cout) const;
+  void save(Checkpoint& c) const;
+  void restore(Checkpoint& c);
 private:
+  // each bigram's tables, by Bigram::key().  a bigram is
+  // erased when its last token goes.
+  typedef FlatMap<uint64_t, Restaurant> Restaurants;
+  Restaurants _restaurants;
+  Count _ntokens;
   // keep track of how many tables this
   // word is on, among all preceding words.
-  typedef SGLexicon<string, Count> Tables;
   Tables _tables;
-  // not quite a "restaurant" in the HDP sense,
-  // since each restaurant tracks tables for only
-  // a single bigram.
-  typedef std::unordered_map<Bigram, Restaurant> Restaurants;
-  typedef pair<Bigram, Restaurant> Restaurant_pair;
-  Restaurants _restaurants;
+  // the successors of each word that has any; a word is erased
+  // with its last bigram.
+  typedef std::unordered_map<WordId, vector<WordId> > Successors;
+  Successors _successors;
+  Float _log_seating;
+  Float _log_labels;
+  // seat a token of b, whose restaurant is r, at a table with k
+  // tokens.  returns true if it is a new table.
+  bool seat(const Bigram& b, Restaurant& r, Count k);
 };
 
 
@@ -0,0 +1,73 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include "Checkpoint.h"
+
+const char Checkpoint::MAGIC[8] = {'S', 'E', 'G', 'C', 'H', 'K', 'P', 0};
+
+void
+Checkpoint::read(void* x, size_t n) {
+  if (n > _data.size() - _pos)
+    corrupt();
+  memcpy(x, _data.data() + _pos, n);
+  _pos += n;
+}
+
+void
+Checkpoint::corrupt() const {
+  error("Checkpoint: the checkpoint is truncated or corrupt");
+}
+
+// the image follows a header of MAGIC, VERSION and the byte order.
+bool
+Checkpoint::write(const std::string& data, const std::string& filename) {
+  std::string tmp = filename + ".tmp";
+  uint64_t header[2] = {VERSION, 0x0102030405060708ULL};
+  {
+    std::ofstream os(tmp.c_str(), std::ios::binary);
+    os.write(MAGIC, sizeof(MAGIC));
+    os.write((const char*)header, sizeof(header));
+    os.write(data.data(), data.size());
+    os.flush();
+    if (!os)
+      return false;
+  }
+  return rename(tmp.c_str(), filename.c_str()) == 0;
+}
+
+void
+Checkpoint::save(const std::string& filename) {
+  wait();
+  _writing.swap(_data);
+  clear();
+  _writer = std::thread([this, filename]() {
+      if (!write(_writing, filename))
+	_ok = false;
+    });
+}
+
+bool
+Checkpoint::wait() {
+  if (_writer.joinable())
+    _writer.join();
+  return _ok;
+}
+
+bool
+Checkpoint::load(const std::string& filename) {
+  wait();
+  std::ifstream is(filename.c_str(), std::ios::binary);
+  char magic[sizeof(MAGIC)];
+  uint64_t header[2];
+  if (!is.read(magic, sizeof(magic)) || memcmp(magic, MAGIC, sizeof(MAGIC)))
+    return false;
+  if (!is.read((char*)header, sizeof(header)))
+    return false;
+  if (header[0] != VERSION || header[1] != 0x0102030405060708ULL)
+    error("Checkpoint::load(): " + filename +
+	  " was written on another machine or by another version");
+  _data.assign(std::istreambuf_iterator<char>(is),
+	       std::istreambuf_iterator<char>());
+  _pos = 0;
+  return true;
+}
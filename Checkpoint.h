@@ -0,0 +1,91 @@
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <stdint.h>
+#include "utils.h"
+
+/*
+Checkpoint is a binary image of the sampler's state, from which a
+run can carry on as if it had never stopped.  Each class appends
+its own part with put() and reads it back, in the same order, with
+get().  Values are copied byte for byte, hash tables slot by slot
+and running sums of logs as they stand rather than recomputed, so
+that everything is visited in the same order and every number has
+the same bits, and a resumed run gives exactly what an
+uninterrupted one would have.
+
+Building the image only copies memory.  save() then hands it to a
+background thread, which writes it to a temporary file and renames
+that over the old checkpoint, so sampling goes on during the write
+and a run killed mid-write still leaves the previous checkpoint.
+*/
+
+class Checkpoint {
+public:
+  Checkpoint(): _pos(0), _ok(true) {}
+  ~Checkpoint() {wait();}
+  // appends x, which must be plain data.
+  template <typename T> void put(const T& x) {
+    _data.append((const char*)&x, sizeof(T));
+  }
+  template <typename T> void put(const std::vector<T>& v) {
+    put((uint64_t)v.size());
+    _data.append((const char*)v.data(), v.size() * sizeof(T));
+  }
+  void put(const std::string& s) {
+    put((uint64_t)s.size());
+    _data.append(s);
+  }
+  // reads back the next value put().
+  template <typename T> void get(T& x) {read(&x, sizeof(T));}
+  template <typename T> void get(std::vector<T>& v) {
+    uint64_t n;
+    get(n);
+    if (n > (_data.size() - _pos) / sizeof(T))
+      corrupt();
+    v.resize(n);
+    read(v.data(), n * sizeof(T));
+  }
+  void get(std::string& s) {
+    uint64_t n;
+    get(n);
+    if (n > _data.size() - _pos)
+      corrupt();
+    s.assign(_data, _pos, n);
+    _pos += n;
+  }
+  // true if everything put() has been read back.
+  bool done() const {return _pos == _data.size();}
+  // empties the image, to start a new one.
+  void clear() {
+    _data.clear();
+    _pos = 0;
+  }
+  // writes the image to filename in the background, and clears
+  // it.  waits first for the previous save() to finish.
+  void save(const std::string& filename);
+  // waits for the last save() to finish.  returns false if it
+  // (or any earlier one) failed.
+  bool wait();
+  // replaces the image with the one saved in filename.  returns
+  // false if filename can't be read or is not a checkpoint.
+  bool load(const std::string& filename);
+private:
+  std::string _data;
+  size_t _pos; // where get() reads next
+  std::string _writing; // the image being saved
+  std::thread _writer;
+  bool _ok;
+  static const char MAGIC[8];
+  static const uint64_t VERSION = 2;
+  void read(void* x, size_t n);
+  void corrupt() const;
+  static bool write(const std::string& data, const std::string& filename);
+  Checkpoint(const Checkpoint&);
+  void operator=(const Checkpoint&);
+};
+
+#endif
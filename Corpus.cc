@@ -0,0 +1,298 @@
+#include <cstring>
+#include <fstream>
+#include "Corpus.h"
+
+const char Corpus::MAGIC[8] = {'S', 'E', 'G', 'C', 'O', 'R', 'P', 0};
+
+void
+Corpus::add_words(const char* text, const char* end, char separator) {
+  my_assert(!_compiled, size());
+  Count begin = _chars.size();
+  for (const char* c = text; c != end; c++) {
+    if (*c != separator) _chars += *c;
+  }
+  Count n = _chars.size() - begin;
+  if (n == 0)  // nothing but separators
+    return;
+  _boundaries.resize(_boundaries.size() + (n+63)/64, 0);
+  _reference.resize(_boundaries.size(), 0);
+  uint64_t* bits = &_reference[_word_at.back()];
+  // a separator marks a reference boundary after the char before
+  // it, if there is one, so leading separators and runs of them
+  // make no empty words.
+  Count i = 0;
+  for (const char* c = text; c != end; c++) {
+    if (*c == separator) {
+      if (i > 0)
+	bits[(i-1) >> 6] |= (uint64_t)1 << ((i-1) & 63);
+    }
+    else
+      i++;
+  }
+  // the end of the utterance is always the end of a word.
+  bits[(n-1) >> 6] |= (uint64_t)1 << ((n-1) & 63);
+  _char_at.push_back(_chars.size());
+  _word_at.push_back(_boundaries.size());
+}
+
+void
+Corpus::parse(const char* text, const char* end) {
+  while (text != end) {
+    const char* eol = (const char*)memchr(text, '\n', end - text);
+    if (!eol)
+      eol = end;
+    if (eol != text)
+      add_words(text, eol, ' ');
+    text = (eol == end) ? end : eol + 1;
+  }
+}
+
+void
+Corpus::append(const Corpus& part) {
+  my_assert(!_compiled && part._ntyped == 0, part.size());
+  Count nchars = _chars.size();
+  Count nwords = _boundaries.size();
+  _chars += part._chars;
+  _boundaries.resize(nwords + part._boundaries.size(), 0);
+  _reference.insert(_reference.end(),
+		    part._reference.begin(), part._reference.end());
+  for (Count u = 1; u < part._char_at.size(); u++) {
+    _char_at.push_back(nchars + part._char_at[u]);
+    _word_at.push_back(nwords + part._word_at[u]);
+  }
+}
+
+void
+Corpus::add_types() {
+  if (_compiled)  //counted when it was saved
+    return;
+  for (; _ntyped < size(); _ntyped++) {
+    _max_length = max(_max_length, _char_at[_ntyped+1] - _char_at[_ntyped]);
+    count_types(_ntyped);
+  }
+}
+
+void
+Corpus::count_types(Count u) {
+  const char* chars = &_chars[_char_at[u]];
+  const uint64_t* bits = &_reference[_word_at[u]];
+  Count n = _char_at[u+1] - _char_at[u];
+  Count b = 0;
+  for (Count e = 0; e < n; e++) {
+    if (!((bits[e >> 6] >> (e & 63)) & 1))
+      continue;
+    size_t ntypes = _types.size();
+    _types.intern(chars + b, e+1 - b);
+    if (_types.size() > ntypes) {  //a new type
+      for (Count i = b; i <= e; i++)
+	_type_chars[(unsigned char)chars[i]]++;
+    }
+    b = e+1;
+  }
+}
+
+Count
+Corpus::alphabet_size() const {
+  Count n = 0;
+  for (Count c = 0; c < _type_chars.size(); c++)
+    n += (_type_chars[c] > 0);
+  return n;
+}
+
+Corpus::Arrays
+Corpus::arrays() const {
+  if (_compiled)
+    return _mapped;
+  Arrays a;
+  a.chars = _chars.data();
+  a.reference = _reference.data();
+  a.char_at = _char_at.data();
+  a.word_at = _word_at.data();
+  return a;
+}
+
+string
+Corpus::reference(Count u) const {
+  Arrays a = arrays();
+  string s;
+  for (Count i = a.char_at[u]; i < a.char_at[u+1]; i++) {
+    s += a.chars[i];
+    Count k = i - a.char_at[u];
+    if ((a.reference[a.word_at[u] + (k >> 6)] >> (k & 63)) & 1)
+      s += SENTINEL;
+  }
+  return s;
+}
+
+void
+Corpus::utterances(Utterances& utterances) {
+  my_assert(_compiled || _ntyped == size(), size());
+  if (!_compiled) {
+    // the arrays grew by doubling; give back the slack before
+    // handing out pointers into them.
+    _chars.shrink_to_fit();
+    _reference.shrink_to_fit();
+    _types = SymbolTable();
+  }
+  Arrays a = arrays();
+  _boundaries.assign(a.word_at[size()], 0);
+  _log_phones.assign(a.char_at[size()] + size(), 0);
+  utterances.clear();
+  utterances.reserve(size());
+  for (Count u = 0; u < size(); u++) {
+    utterances.push_back(Utterance(a.chars + a.char_at[u],
+				   a.char_at[u+1] - a.char_at[u],
+				   &_boundaries[a.word_at[u]],
+				   a.reference + a.word_at[u],
+				   &_log_phones[a.char_at[u] + u]));
+  }
+}
+
+void
+Corpus::print(ostream& os, const uint64_t* boundaries) const {
+  Arrays a = arrays();
+  string line;
+  for (Count u = 0; u < size(); u++) {
+    const uint64_t* bits = boundaries + a.word_at[u];
+    const char* chars = a.chars + a.char_at[u];
+    Count n = a.char_at[u+1] - a.char_at[u];
+    line.clear();
+    for (Count i = 0; i < n; i++) {
+      line += chars[i];
+      if (i+1 < n && ((bits[i >> 6] >> (i & 63)) & 1))
+	line += ' ';
+    }
+    line += '\n';
+    os << line;
+  }
+}
+
+Count
+Corpus::nchars() const {
+  return arrays().char_at[size()];
+}
+
+void
+Corpus::save_boundaries(Checkpoint& c) const {
+  c.put(size());
+  c.put(nchars());
+  c.put(_boundaries);
+}
+
+// the Utterances point into _boundaries, so it is copied into
+// rather than replaced.
+void
+Corpus::restore_boundaries(Checkpoint& c) {
+  Count n, nchars;
+  c.get(n);
+  c.get(nchars);
+  if (n != size() || nchars != this->nchars())
+    error("Corpus::restore_boundaries(): the checkpoint is of another corpus");
+  Bits boundaries;
+  c.get(boundaries);
+  my_assert(boundaries.size() == _boundaries.size(), boundaries.size());
+  std::copy(boundaries.begin(), boundaries.end(), _boundaries.begin());
+}
+
+// writes n bytes from data, and pads them to a multiple of 8.
+static void
+write_padded(ofstream& os, const void* data, size_t n) {
+  static const char zeros[8] = {0};
+  os.write((const char*)data, n);
+  os.write(zeros, (8 - n % 8) % 8);
+}
+
+static size_t
+padded(size_t n) {
+  return (n + 7) / 8 * 8;
+}
+
+bool
+Corpus::save(const string& filename) const {
+  my_assert(_compiled || _ntyped == size(), size());
+  Arrays a = arrays();
+  Header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, MAGIC, sizeof(MAGIC));
+  h.version = VERSION;
+  h.byte_order = 0x0102030405060708ULL;
+  h.nutterances = size();
+  h.nwords = a.word_at[size()];
+  h.nchars = a.char_at[size()];
+  h.max_length = _max_length;
+  for (Count c = 0; c < 256; c++)
+    h.type_chars[c] = _type_chars[c];
+  ofstream os(filename.c_str(), ios::binary);
+  if (!os)
+    return false;
+  write_padded(os, &h, sizeof(h));
+  write_padded(os, a.char_at, (size()+1) * sizeof(Count));
+  write_padded(os, a.word_at, (size()+1) * sizeof(Count));
+  write_padded(os, a.reference, h.nwords * sizeof(uint64_t));
+  write_padded(os, a.chars, h.nchars);
+  return os.good();
+}
+
+bool
+Corpus::compiled(const string& filename) {
+  char magic[sizeof(MAGIC)];
+  ifstream is(filename.c_str(), ios::binary);
+  return is.read(magic, sizeof(magic)) && !memcmp(magic, MAGIC, sizeof(MAGIC));
+}
+
+bool
+Corpus::open(const string& filename) {
+  // the offsets are saved as 64-bit Counts.
+  if (sizeof(Count) != sizeof(uint64_t))
+    error("Corpus::open(): compiled corpora need a 64-bit Count");
+  my_assert(size() == 0 && !_compiled, size());
+  if (!_file.open(filename) || _file.size() < sizeof(Header))
+    return false;
+  const Header* h = (const Header*)_file.data();
+  if (memcmp(h->magic, MAGIC, sizeof(MAGIC)))
+    return false;
+  if (h->byte_order != 0x0102030405060708ULL || h->version != VERSION)
+    error("Corpus::open(): " + filename +
+	  " was compiled on another machine or by another version");
+  const char* p = _file.data() + padded(sizeof(Header));
+  _mapped.char_at = (const Count*)p;
+  p += padded((h->nutterances+1) * sizeof(Count));
+  _mapped.word_at = (const Count*)p;
+  p += padded((h->nutterances+1) * sizeof(Count));
+  _mapped.reference = (const uint64_t*)p;
+  p += padded(h->nwords * sizeof(uint64_t));
+  _mapped.chars = p;
+  p += padded(h->nchars);
+  if (p != _file.data() + _file.size())
+    error("Corpus::open(): " + filename + " is truncated or corrupt");
+  _header = h;
+  _max_length = h->max_length;
+  for (Count c = 0; c < 256; c++)
+    _type_chars[c] = h->type_chars[c];
+  _compiled = true;
+  return true;
+}
+
+void
+Corpus::clear() {
+  _file.close();
+  _compiled = false;
+  string().swap(_chars);
+  Bits().swap(_boundaries);
+  Bits().swap(_reference);
+  Fs().swap(_log_phones);
+  Cs(1, 0).swap(_char_at);
+  Cs(1, 0).swap(_word_at);
+  _ntyped = 0;
+  _max_length = 0;
+  _type_chars.assign(256, 0);
+  _types = SymbolTable();
+}
+
+size_t
+Corpus::memory() const {
+  return _chars.capacity() +
+    (_boundaries.capacity() + _reference.capacity()) * sizeof(uint64_t) +
+    _log_phones.capacity() * sizeof(Float) +
+    (_char_at.capacity() + _word_at.capacity()) * sizeof(Count);
+}
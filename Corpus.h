@@ -0,0 +1,150 @@
+#ifndef _CORPUS_H_
+#define _CORPUS_H_
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "typedefs.h"
+#include "Utterance.h"
+#include "MappedFile.h"
+#include "Checkpoint.h"
+
+/*
+Corpus holds the text of all the utterances in a few flat arrays,
+one after another, so that a sweep over the utterances in order
+reads each array from front to back and nothing is allocated per
+utterance.  For utterance u:
+
+  chars[char_at[u] .. char_at[u+1]) are its characters,
+  _boundaries[word_at[u] .. word_at[u+1]) its boundary bits, and
+  _log_phones from char_at[u] + u its prefix sums of log
+  phoneme probs (one more than it has characters).
+
+The reference segmentation is a separate bitset, laid out like
+the boundaries, which is only read when scoring.  The reference
+statistics the model needs (the length of the longest utterance,
+and how often each character occurs in the reference word types)
+are kept as the types are counted.  Nothing is interned in
+SymbolTable::WORDS: the sampler looks words up by their
+characters, and interns them as it seats them, so the corpus
+takes space linear in its text however long its lines are.
+
+Text is added in two steps: parse() or append() reads the
+characters and reference boundaries, which needs nothing shared,
+so several parts of a file can be parsed at once into Corpora of
+their own; add_types() then counts the new reference word types,
+in order.  utterances() makes the
+Utterances, which are small views of these arrays; they stay
+valid as long as nothing is added.
+
+save() writes the corpus to a binary file which open() maps, so
+that a later run starts without parsing anything: the read-only arrays are used in
+place, and only the boundaries and the log phoneme sums (which
+depend on the run) are allocated.
+*/
+
+class Corpus {
+public:
+  Corpus(): _char_at(1, 0), _word_at(1, 0), _ntyped(0),
+	    _max_length(0), _type_chars(256, 0), _compiled(false) {}
+  // adds an utterance given as its words, each followed by
+  // SENTINEL, and counts its types.
+  void add(const string& reference) {
+    add_words(reference.data(), reference.data() + reference.size(),
+	      SENTINEL);
+    add_types();
+  }
+  // adds the utterances in text, one per line, with spaces
+  // between words.  extra spaces are ignored, and lines with
+  // nothing but spaces are skipped.
+  void parse(const char* text, const char* end);
+  // adds the utterances of part (whose types have not been
+  // counted).
+  void append(const Corpus& part);
+  // counts the reference word types of the utterances added since
+  // the last call, and their lengths.
+  void add_types();
+  Count size() const {
+    return _compiled ? _header->nutterances : _char_at.size() - 1;
+  }
+  // the number of characters in all the utterances.
+  Count nchars() const;
+  // the number of characters in the longest utterance.
+  Count max_length() const {return _max_length;}
+  // the number of distinct characters.
+  Count alphabet_size() const;
+  // how many times c occurs in the reference word types.
+  Count type_chars(unsigned char c) const {return _type_chars[c];}
+  // utterance u as its reference words, each followed by SENTINEL.
+  string reference(Count u) const;
+  // sets utterances to views of the utterances added so far.
+  void utterances(Utterances& utterances);
+  // writes the corpus to filename.
+  // returns false if the file can't be written.
+  bool save(const string& filename) const;
+  // fills this (empty) corpus with the one saved in filename.
+  // returns false if filename is not a compiled corpus.
+  bool open(const string& filename);
+  // removes everything, and frees the storage.
+  void clear();
+  // true if filename begins like a compiled corpus.
+  static bool compiled(const string& filename);
+  // the boundaries of all the utterances, one after another.
+  const vector<uint64_t>& boundaries() const {return _boundaries;}
+  // writes each utterance on a line, as its words separated by
+  // spaces, where the words end at boundaries (laid out like
+  // boundaries()).
+  void print(ostream& os, const uint64_t* boundaries) const;
+  // appends the boundaries to c, or sets them to the ones read
+  // from c (which must have been saved from the same corpus).
+  void save_boundaries(Checkpoint& c) const;
+  void restore_boundaries(Checkpoint& c);
+  // bytes held by the arrays (not counting a mapped file).
+  size_t memory() const;
+private:
+  typedef vector<uint64_t> Bits;
+  string _chars;
+  Bits _boundaries;
+  Bits _reference;
+  Fs _log_phones;
+  Cs _char_at;
+  Cs _word_at;
+  Count _ntyped; // the utterances whose types have been counted
+  Count _max_length;
+  Cs _type_chars;
+  SymbolTable _types; // the reference words seen so far
+  // the start of a compiled corpus.  the arrays follow in the
+  // order of the fields that give their sizes, each padded to a
+  // multiple of 8 bytes.
+  struct Header {
+    char magic[8];
+    uint64_t version;
+    uint64_t byte_order;
+    uint64_t nutterances; // char_at, word_at: n+1 each
+    uint64_t nwords; // reference
+    uint64_t nchars; // chars
+    uint64_t max_length;
+    uint64_t type_chars[256];
+  };
+  static const char MAGIC[8];
+  static const uint64_t VERSION = 2;
+  bool _compiled;
+  MappedFile _file;
+  const Header* _header;
+  // the read-only arrays, in the vectors above or in _file.
+  struct Arrays {
+    const char* chars;
+    const uint64_t* reference;
+    const Count* char_at;
+    const Count* word_at;
+  };
+  Arrays _mapped;
+  Arrays arrays() const;
+  // adds the utterance in [text, end), whose words are separated
+  // by separator, unless it has no words.
+  void add_words(const char* text, const char* end, char separator);
+  // counts the reference words of utterance u in _type_chars.
+  void count_types(Count u);
+};
+
+#endif
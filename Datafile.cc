@@ -1,13 +1,31 @@
 #include <algorithm>
+#include <cstring>
+#include <thread>
 #include "Datafile.h"
+#include "Corpus.h"
 #include "utils.h"
 
 using namespace std;
 
+size_t
+DatafileBase::load(Corpus& corpus, Count nthreads)
+{
+  size_t bytes = 0;
+  string s = next_reference();
+  while (!s.empty()) {
+    bytes += s.size();
+    corpus.add(s);
+    s = next_reference();
+  }
+  return bytes;
+}
+
 Datafile::Datafile(const string& filename) throw(FileError)
-  : _file(filename.c_str()), _filename(filename.c_str())
 {
-  if (!_file) throw FileError();
+  if (!_file.open(filename, true)) throw FileError();
+  _text = _file.data();
+  _end = _text + _file.size();
+  _next = _text;
 }
 
 /* skips blank lines, returning next reference
@@ -15,51 +33,92 @@ transcription.  Removes spaces, but inserts SENTINEL
 character after each word.  
 Returns empty string at eof. */
 string
-Datafile::next_reference() throw(UtteranceLength)
+Datafile::next_reference()
 {
-  if (!_file) {
+  // ignore empty lines
+  while (_next != _end && *_next == '\n')
+    _next++;
+  if (_next == _end)
     return string();
-  }
+  const char* eol = (const char*)memchr(_next, '\n', _end - _next);
+  if (!eol)
+    eol = _end;
+  string reference(_next, eol);
+  replace(reference.begin(), reference.end(), ' ', SENTINEL);
+  reference += SENTINEL;
+  _next = eol;
+  return reference;
+}
 
-  char buffer[Utterance::MAX_LENGTH];
-  char c;
-  int index = 0;
-  
-  // ignore empty lines
-  while (_file.get(c) && c  == '\n') {
-  }
-  _file.putback(c);
-  while (_file.get(c) && c != '\n') {
-    if (index == Utterance::MAX_LENGTH) {
-      throw UtteranceLength(buffer);
-    }
-    if (c == ' ') {
-      buffer[index] = SENTINEL;
+size_t
+Datafile::load(Corpus& corpus, Count nthreads)
+{
+  const char* text = _next;
+  size_t bytes = _end - text;
+  nthreads = max(min(nthreads, bytes / (1 << 20)), (Count)1);
+  if (nthreads == 1)
+    corpus.parse(text, _end);
+  else {
+    // chunk t is [ends[t], ends[t+1]), each ending after a newline.
+    vector<const char*> ends(nthreads+1, _end);
+    ends[0] = text;
+    for (Count t = 1; t < nthreads; t++) {
+      const char* e = max(text + bytes*t/nthreads, ends[t-1]);
+      const char* eol = (const char*)memchr(e, '\n', _end - e);
+      ends[t] = eol ? eol + 1 : _end;
     }
-    else {
-      buffer[index] = c;
+    vector<Corpus> parts(nthreads);
+    vector<thread> threads;
+    for (Count t = 1; t < nthreads; t++)
+      threads.push_back(thread(&Corpus::parse, &parts[t],
+			       ends[t], ends[t+1]));
+    parts[0].parse(ends[0], ends[1]);
+    for (Count t = 0; t < threads.size(); t++)
+      threads[t].join();
+    for (Count t = 0; t < nthreads; t++) {
+      corpus.append(parts[t]);
+      parts[t].clear();
     }
-    index++;
   }
-  // happens at end of file
-  if (index == 0) {
-    return string();
+  _next = _end;
+  // the text is in the corpus now.
+  _file.drop();
+  return bytes;
+}
+
+CompiledDatafile::CompiledDatafile(const string& filename) throw(FileError)
+  : _filename(filename), _corpus(new Corpus()), _next(0)
+{
+  if (!_corpus->open(filename)) {
+    delete _corpus;
+    throw FileError();
   }
-  buffer[index++] = SENTINEL;
-  buffer[index] = 0;
-  return buffer;
 }
 
-void
-Datafile::reset()
+CompiledDatafile::~CompiledDatafile()
+{
+  delete _corpus;
+}
+
+string
+CompiledDatafile::next_reference()
+{
+  if (_next == _corpus->size()) return string();
+  return _corpus->reference(_next++);
+}
+
+size_t
+CompiledDatafile::load(Corpus& corpus, Count nthreads)
 {
-  error("Datafile::reset doesn't work; fix it!");
-  _file.close();
-  _file.open(_filename);
+  my_assert(_next == 0, _next);
+  if (!corpus.open(_filename))
+    error("CompiledDatafile::load(): can't read " + _filename);
+  _next = corpus.size();
+  return 0;
 }
 
 RepeatDatafile::RepeatDatafile(const string& filename)
-  throw (UtteranceLength, FileError)
+  throw (FileError)
 {
   Datafile file(filename);
   string utterance = file.next_reference();
@@ -83,7 +142,7 @@ RepeatDatafile::reset()
   _current = _utterances.begin();
 }
 
-RandomDatafile::RandomDatafile(const string& filename) throw(UtteranceLength, FileError)
+RandomDatafile::RandomDatafile(const string& filename) throw(FileError)
 {
   Datafile file(filename);
   string utterance = file.next_reference();
@@ -105,7 +164,7 @@ _seed = time(0);
   _current = _utterances.begin();
 }
 
-RandomDatafile::RandomDatafile(const string& filename, long seed) throw(UtteranceLength, FileError)
+RandomDatafile::RandomDatafile(const string& filename, long seed) throw(FileError)
 {
   Datafile file(filename);
   string utterance = file.next_reference();
@@ -128,7 +187,7 @@ RandomDatafile::RandomDatafile(const string& filename, long seed) throw(Utteranc
 }
 
 string
-RandomDatafile::next_reference() // throw(UtteranceLength)
+RandomDatafile::next_reference()
 {
   if (_current == _utterances.end()) return string();
   return *_current++;
@@ -4,23 +4,15 @@
 #include <fstream>
 #include <iostream>
 #include "Utterance.h"
+#include "MappedFile.h"
 
 using std::string;
 using std::vector;
 
 // exception classes
 class FileError {};
-class UtteranceLength {
-public:
-  UtteranceLength(const std::string& u):_u(u) {};
-  void print() {cout << "Error: Utterance is too long:" << endl
-		     << _u << endl 
-		     << "(Increase Utterance::MAX_LENGTH)" << endl;}
-private:
-  string _u;
-};
-
 
+class Corpus;
 
 class DatafileBase {
 public:
@@ -29,27 +21,61 @@ public:
   // return the next reference transcription in some order.
   // each transcription in file will be returned exactly once
   // returns empty string when no more transcriptions.
-  virtual string next_reference() = 0;//throw(UtteranceLength) = 0;
+  virtual string next_reference() = 0;
   // reset to a state as if you had created a new Datafile
   virtual void reset() = 0;
+  // add every remaining transcription to corpus, in the order
+  // next_reference() would give them, using up to nthreads
+  // threads.  the types may be left for Corpus::add_types().
+  // returns the number of bytes of text parsed.
+  virtual size_t load(Corpus& corpus, Count nthreads=1);
 };
 
+/*
+Datafile maps the whole file into memory, so reading it costs
+no copies beyond the one into the Corpus, and lines may be of
+any length.  load() splits the file into one chunk per thread
+at line ends and parses the chunks at once.  It leaves the
+reference types to be counted afterwards, in file order.
+*/
 class Datafile: public DatafileBase {
 public:
   Datafile(const string& filename) throw(FileError);
   virtual ~Datafile() {}
   // get next reference transcription in order from file
-  virtual string next_reference() throw(UtteranceLength);
-  virtual void reset();
+  virtual string next_reference();
+  virtual void reset() {_next = _text;}
+  virtual size_t load(Corpus& corpus, Count nthreads=1);
 private:
-  ifstream _file;
-  const char* _filename;
+  MappedFile _file;
+  const char* _text; // the file's contents
+  const char* _end;
+  const char* _next; // start of the next line to read
+};
+
+/*
+CompiledDatafile reads a corpus written by Corpus::save() (with
+segment --compile-corpus).  load() maps it into the Corpus, with
+its reference statistics, so there is nothing to parse;
+next_reference() rebuilds the transcriptions
+from it, for the other uses of a Datafile.
+*/
+class CompiledDatafile: public DatafileBase {
+public:
+  CompiledDatafile(const string& filename) throw(FileError);
+  virtual ~CompiledDatafile();
+  virtual string next_reference();
+  virtual void reset() {_next = 0;}
+  virtual size_t load(Corpus& corpus, Count nthreads=1);
+private:
+  string _filename;
+  Corpus* _corpus; // for next_reference()
+  Count _next; // the next utterance it returns
 };
 
 class RepeatDatafile: public DatafileBase {
 public:
-  RepeatDatafile(const string& filename) throw(UtteranceLength,
-					       FileError);
+  RepeatDatafile(const string& filename) throw(FileError);
   virtual ~RepeatDatafile() {}
   virtual string next_reference();
   virtual void reset();
@@ -60,15 +86,13 @@ private:
 
 class RandomDatafile: public DatafileBase {
 public:
-  RandomDatafile(const string& filename) throw(UtteranceLength,
-					       FileError);
-  RandomDatafile(const string& filename, long seed) throw(UtteranceLength,
-					       FileError);
+  RandomDatafile(const string& filename) throw(FileError);
+  RandomDatafile(const string& filename, long seed) throw(FileError);
   virtual ~RandomDatafile() {}
   long seed() {return _seed;}
   const string& seed_type() {return _seed_type;}
   // get next reference transcription in random order
-  virtual string next_reference();// throw(UtteranceLength);
+  virtual string next_reference();
   virtual void reset();
 private:
   vector<string> _utterances;
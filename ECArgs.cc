@@ -20,6 +20,14 @@ ECArgs(int argc, char *argv[], const string& argoptstr)
 	{
 	  argList.push_back(arg);
 	}
+      else if (arg.compare(0, 2, "--") == 0)
+	{
+	  // --name or --name=value
+	  nopts_++;
+	  size_t eq = arg.find('=');
+	  optList.push_back(arg.substr(2, eq == string::npos ? eq : eq-2));
+	  optList.push_back(eq == string::npos ? "" : arg.substr(eq+1));
+	}
       else
 	{
 	  nopts_++;
@@ -49,8 +57,13 @@ bool
 ECArgs::
 isset(char c) const
 {
-  string sig = "";
-  sig += c;
+  return isset(string(1, c));
+}
+
+bool
+ECArgs::
+isset(const string& sig) const
+{
   for (size_t i=0; i<optList.size(); i+=2) {
     if (optList[i] == sig) return true;
   }
@@ -62,8 +75,13 @@ string
 ECArgs::
 value(char c) const
 {
-  string sig;
-  sig += c;
+  return value(string(1, c));
+}
+
+string
+ECArgs::
+value(const string& sig) const
+{
   size_t i;
   for (i=0; i<optList.size(); i+=2) {
     if (optList[i] == sig) 
@@ -73,5 +91,3 @@ value(char c) const
   error("could not find value");
   return "";
 }
-
-
@@ -13,6 +13,9 @@ class ECArgs
   int nargs() const { return argList.size(); }
   bool isset(char c) const;
   std::string value(char c) const;
+  // long options, given as --name or --name=value
+  bool isset(const std::string& name) const;
+  std::string value(const std::string& name) const;
   std::string arg(int n) const { return argList[n]; }
  private:
   int nargs_;
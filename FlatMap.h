@@ -0,0 +1,168 @@
+#ifndef _FLATMAP_H_
+#define _FLATMAP_H_
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <functional>
+#include <stdint.h>
+#include "Rng.h"
+
+/*
+FlatMap is a hash map stored in one array of (key, value) slots
+with linear probing.  A lookup is a hash and, usually, one or two
+adjacent slots, and there is no per-entry allocation.  Erasing
+shifts the following entries of the run back, so there are no
+tombstones and lookups do not slow down as entries come and go.
+The table doubles when it would be more than 3/4 full.
+
+FlatKey<Key> gives the hash of a key and the key that marks an
+empty slot, which may not be used as a real key.  Iterators and
+pointers to values are invalidated by insert() and erase();
+values are moved (not copied) when the table grows or entries
+shift.  Slots have members first and second, so iterating looks
+like iterating over a std::unordered_map.
+*/
+
+template <typename Key> struct FlatKey;
+
+template <> struct FlatKey<uint64_t> {
+  static uint64_t empty() {return ~(uint64_t)0;}
+  static size_t hash(uint64_t k) {return Rng::mix(k);}
+};
+
+template <> struct FlatKey<uint32_t> {
+  static uint32_t empty() {return ~(uint32_t)0;}
+  static size_t hash(uint32_t k) {return Rng::mix(k);}
+};
+
+// words never contain a NUL.
+template <> struct FlatKey<std::string> {
+  static std::string empty() {return std::string(1, '\0');}
+  static size_t hash(const std::string& k) {
+    return Rng::mix(std::hash<std::string>()(k));
+  }
+};
+
+template <typename Key, typename Value>
+class FlatMap {
+public:
+  typedef FlatKey<Key> Traits;
+  struct Slot {
+    Key first;
+    Value second;
+    Slot(): first(Traits::empty()), second() {}
+    bool full() const {return !(first == Traits::empty());}
+  };
+  template <typename S>
+  class Iter {
+  public:
+    Iter(S* s, S* end): _s(s), _end(end) {skip();}
+    S& operator*() const {return *_s;}
+    S* operator->() const {return _s;}
+    Iter& operator++() {++_s; skip(); return *this;}
+    Iter operator++(int) {Iter i = *this; ++*this; return i;}
+    bool operator==(const Iter& i) const {return _s == i._s;}
+    bool operator!=(const Iter& i) const {return _s != i._s;}
+    operator Iter<const S>() const {return Iter<const S>(_s, _end);}
+  private:
+    friend class FlatMap;
+    S* _s;
+    S* _end;
+    void skip() {while (_s != _end && !_s->full()) ++_s;}
+  };
+  typedef Iter<Slot> iterator;
+  typedef Iter<const Slot> const_iterator;
+
+  FlatMap(): _size(0) {}
+  size_t size() const {return _size;}
+  bool empty() const {return _size == 0;}
+  void clear() {
+    _slots.clear();
+    _size = 0;
+  }
+  iterator begin() {return iterator(first_slot(), last_slot());}
+  iterator end() {return iterator(last_slot(), last_slot());}
+  const_iterator begin() const {return const_iterator(first_slot(), last_slot());}
+  const_iterator end() const {return const_iterator(last_slot(), last_slot());}
+  iterator find(const Key& key) {
+    if (_slots.empty()) return end();
+    for (size_t i = home(key); ; i = next(i)) {
+      if (_slots[i].first == key) return at(i);
+      if (!_slots[i].full()) return end();
+    }
+  }
+  const_iterator find(const Key& key) const {
+    return const_cast<FlatMap*>(this)->find(key);
+  }
+  //the entry of key, whose value is default constructed if it is
+  //new; the flag is true if it is.
+  std::pair<iterator, bool> insert(const Key& key) {
+    if (4*(_size+1) > 3*_slots.size())
+      grow();
+    size_t i = home(key);
+    for (; _slots[i].full(); i = next(i)) {
+      if (_slots[i].first == key)
+	return std::make_pair(at(i), false);
+    }
+    _slots[i].first = key;
+    _size++;
+    return std::make_pair(at(i), true);
+  }
+  void erase(iterator it) {
+    size_t i = it._s - &_slots[0];
+    //move back any later entry of the run that may sit at i.
+    for (size_t j = next(i); _slots[j].full(); j = next(j)) {
+      size_t h = home(_slots[j].first);
+      //j's entry may move to i if i is cyclically in [h, j).
+      if (((j - h) & mask()) >= ((j - i) & mask())) {
+	_slots[i].first = std::move(_slots[j].first);
+	_slots[i].second = std::move(_slots[j].second);
+	i = j;
+      }
+    }
+    _slots[i].first = Traits::empty();
+    _slots[i].second = Value();
+    _size--;
+  }
+  //removes key, which must be in the map.
+  void erase(const Key& key) {erase(find(key));}
+  //bytes held by the table itself (not by the keys or values).
+  size_t memory() const {return _slots.capacity() * sizeof(Slot);}
+  //the slots, empty ones included.  a map given them by assign()
+  //has every entry in the same place, so it iterates in the same
+  //order as this one.
+  const std::vector<Slot>& slots() const {return _slots;}
+  void assign(std::vector<Slot>& slots) {
+    _slots.swap(slots);
+    _size = 0;
+    for (size_t i = 0; i < _slots.size(); i++)
+      _size += _slots[i].full();
+  }
+private:
+  std::vector<Slot> _slots; //size is 0 or a power of 2
+  size_t _size;
+  size_t mask() const {return _slots.size() - 1;}
+  size_t home(const Key& key) const {return Traits::hash(key) & mask();}
+  size_t next(size_t i) const {return (i + 1) & mask();}
+  Slot* first_slot() {return _slots.empty() ? 0 : &_slots[0];}
+  Slot* last_slot() {return first_slot() + _slots.size();}
+  const Slot* first_slot() const {return _slots.empty() ? 0 : &_slots[0];}
+  const Slot* last_slot() const {return first_slot() + _slots.size();}
+  iterator at(size_t i) {return iterator(&_slots[i], last_slot());}
+  void grow() {
+    std::vector<Slot> old;
+    old.swap(_slots);
+    _slots.resize(old.empty() ? 16 : 2*old.size());
+    for (size_t k = 0; k < old.size(); k++) {
+      if (!old[k].full()) continue;
+      size_t i = home(old[k].first);
+      while (_slots[i].full())
+	i = next(i);
+      _slots[i].first = std::move(old[k].first);
+      _slots[i].second = std::move(old[k].second);
+    }
+  }
+};
+
+#endif
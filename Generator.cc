@@ -0,0 +1,96 @@
+#include <unordered_set>
+#include "Generator.h"
+#include "Utterance.h"
+
+// the letters, most familiar first.
+static const string VOWELS = "aeiouyAEIOUY0123456789";
+static const string CONSONANTS = "bcdfghjklmnpqrstvwxzBCDFGHJKLMNPQRSTVWXZ"
+  "!\"#$%&'()*+,-./:;<=>?@[\\]^_`{}~";
+
+void
+Generator::poisson_urn(CountUrn& urn, Float mean, Count max) {
+  urn.clear();
+  Float p = exp(-(mean - 1));
+  for (Count k = 0; k < max; k++) {
+    urn.push(k + 1, p);
+    p *= (mean - 1) / (k + 1);
+  }
+  urn.build_alias();
+}
+
+void
+Generator::zipf_urn(CountUrn& urn, Count n, Float s) {
+  urn.clear();
+  urn.reserve(n);
+  for (Count k = 0; k < n; k++)
+    urn.push(k, pow(k + 1, -s));
+  urn.build_alias();
+}
+
+Generator::Generator(Count alphabet_size, Count lexicon_size,
+		     Float word_length, Float utterance_length,
+		     Float zipf, uint64_t seed): _rng(seed) {
+  my_assert(VOWELS.size() + CONSONANTS.size() == MAX_ALPHABET_SIZE &&
+	    CONSONANTS.find(SENTINEL) == string::npos, CONSONANTS);
+  if (alphabet_size < 2 || alphabet_size > MAX_ALPHABET_SIZE)
+    error("Generator: the alphabet must have 2 to " +
+	  to_string(MAX_ALPHABET_SIZE) + " letters");
+  if (word_length < 1 || utterance_length < 1)
+    error("Generator: words and utterances must have a mean length of at least 1");
+  Rng* saved = thread_rng_state();
+  thread_rng_state() = &_rng;
+  Count nvowels = max(max(alphabet_size / 5, (Count)1),
+		      alphabet_size - min(alphabet_size, CONSONANTS.size()));
+  CountUrn vowels, consonants, word_lengths;
+  zipf_urn(vowels, nvowels, 1);
+  zipf_urn(consonants, alphabet_size - nvowels, 1);
+  poisson_urn(word_lengths, word_length, 4*word_length + 10);
+  poisson_urn(_utterance_lengths, utterance_length, 4*utterance_length + 10);
+  unordered_set<string> seen;
+  // give up if most new words are repeats (the alphabet is too
+  // small for the lexicon).
+  Count repeats = 0;
+  while (_lexicon.size() < lexicon_size) {
+    Count n = word_lengths.draw();
+    string word;
+    bool vowel = randd() >= .7;
+    for (Count k = 0; k < n; k++) {
+      word += vowel ? VOWELS[vowels.draw()] : CONSONANTS[consonants.draw()];
+      vowel = vowel ? randd() >= .7 : randd() < .8;
+    }
+    if (seen.insert(word).second)
+      _lexicon.push_back(word);
+    else if (++repeats > 10*lexicon_size + 1000)
+      error("Generator: can't make " + to_string(lexicon_size) +
+	    " distinct words from " + to_string(alphabet_size) + " letters");
+  }
+  zipf_urn(_words, lexicon_size, zipf);
+  thread_rng_state() = saved;
+}
+
+void
+Generator::generate(Count n, string& text) {
+  Rng* saved = thread_rng_state();
+  thread_rng_state() = &_rng;
+  for (Count u = 0; u < n; u++) {
+    Count length = _utterance_lengths.draw();
+    for (Count k = 0; k < length; k++) {
+      if (k) text += ' ';
+      text += _lexicon[_words.draw()];
+    }
+    text += '\n';
+  }
+  thread_rng_state() = saved;
+}
+
+void
+Generator::generate(Count n, ostream& os) {
+  // in blocks, so that the text is never all in memory.
+  const Count BLOCK = 100000;
+  string text;
+  for (Count u = 0; u < n; u += BLOCK) {
+    text.clear();
+    generate(min(BLOCK, n - u), text);
+    os.write(text.data(), text.size());
+  }
+}
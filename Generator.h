@@ -0,0 +1,55 @@
+#ifndef _GENERATOR_H_
+#define _GENERATOR_H_
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include "typedefs.h"
+#include "Rng.h"
+#include "Urn.h"
+
+/*
+Generator makes synthetic corpora, of any size, without a trained
+State, for benchmarks and tests.  It first makes a lexicon of
+distinct random words over an alphabet of the given size.  A fifth
+of the letters are vowels and the rest consonants, and within each
+class the letters are Zipfian, the familiar ones most frequent.
+A word's letters alternate between the classes more often than not
+(a consonant is followed by a vowel with prob .8, and a vowel by a
+consonant with prob .7), so words look roughly like CV syllables.
+A word has 1 + Poisson(word_length - 1) letters.  An utterance has
+1 + Poisson(utterance_length - 1) tokens, drawn from a Zipfian
+distribution (with exponent zipf) over the lexicon.
+
+The output is in the usual input format: an utterance per line
+with a space between words, so the spaces are the gold
+boundaries.  Every draw comes from an alias urn, so a token costs
+O(1), and the same settings and seed always give the same corpus.
+*/
+
+class Generator {
+public:
+  Generator(Count alphabet_size=26, Count lexicon_size=10000,
+	    Float word_length=3.5, Float utterance_length=3.5,
+	    Float zipf=1, uint64_t seed=0);
+  // appends n utterances to text.
+  void generate(Count n, string& text);
+  // writes n utterances to os.
+  void generate(Count n, ostream& os);
+  const vector<string>& lexicon() const {return _lexicon;}
+  // the letters are the printable characters other than space
+  // and SENTINEL.
+  static const Count MAX_ALPHABET_SIZE = 93;
+private:
+  typedef Urn<Count, Float> CountUrn;
+  Rng _rng;
+  vector<string> _lexicon;
+  CountUrn _words; //ids in _lexicon, Zipfian
+  CountUrn _utterance_lengths;
+  //1 + Poisson(mean - 1), cut off at max.
+  static void poisson_urn(CountUrn& urn, Float mean, Count max);
+  //0 .. n-1, with weights 1/(k+1)^s.
+  static void zipf_urn(CountUrn& urn, Count n, Float s);
+};
+
+#endif
@@ -0,0 +1,68 @@
+#include <fstream>
+#include <iterator>
+#ifndef OS_WINDOWS
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "MappedFile.h"
+
+using namespace std;
+
+bool
+MappedFile::open(const string& filename, bool sequential)
+{
+  close();
+#ifdef OS_WINDOWS
+  ifstream file(filename.c_str(), ios::binary);
+  if (!file) return false;
+  _buffer.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+  _size = _buffer.size();
+#else
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    ::close(fd);
+    return false;
+  }
+  if (st.st_size > 0) {
+    void* map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      ::close(fd);
+      return false;
+    }
+    if (sequential)
+      madvise(map, st.st_size, MADV_SEQUENTIAL);
+    _map = map;
+    _size = st.st_size;
+  }
+  ::close(fd);
+#endif
+  _data = _map ? (const char*)_map : _buffer.data();
+  return true;
+}
+
+void
+MappedFile::close()
+{
+#ifndef OS_WINDOWS
+  if (_map)
+    munmap(_map, _size);
+#endif
+  _map = 0;
+  _buffer.clear();
+  _data = 0;
+  _size = 0;
+}
+
+void
+MappedFile::drop()
+{
+#ifndef OS_WINDOWS
+  // they are read back from the file if they are touched again.
+  if (_map)
+    madvise(_map, _size, MADV_DONTNEED);
+#endif
+}
@@ -0,0 +1,35 @@
+#ifndef _MAPPEDFILE_H_
+#define _MAPPEDFILE_H_
+
+#include <string>
+
+/*
+MappedFile gives the contents of a file as one read-only array.
+Where there is mmap() the file is mapped, so nothing is copied
+and only the pages that are touched are read; elsewhere it is
+read into memory.  The contents stay valid until close() or the
+MappedFile is destroyed.
+*/
+
+class MappedFile {
+public:
+  MappedFile(): _data(0), _size(0), _map(0) {}
+  ~MappedFile() {close();}
+  // returns false if the file can't be opened.  sequential says
+  // the file will be read once, front to back.
+  bool open(const std::string& filename, bool sequential=false);
+  void close();
+  const char* data() const {return _data;}
+  size_t size() const {return _size;}
+  // the pages read so far are not needed again soon.
+  void drop();
+private:
+  const char* _data;
+  size_t _size;
+  void* _map; // the mapping, or 0 if there is none
+  std::string _buffer; // the contents, where there is no mmap()
+  MappedFile(const MappedFile&);
+  void operator=(const MappedFile&);
+};
+
+#endif
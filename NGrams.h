@@ -1,21 +1,29 @@
 #ifndef _NGRAMS_H_
 #define _NGRAMS_H_
 
+#include <string>
+#include "SymbolTable.h"
+#include "FlatMap.h"
+
+// a pair of interned words.
 struct Bigram {
-  Bigram(const std::string& f, const std::string& s) : first(f), second(s) {}
-  virtual ~Bigram() {}
-  std::string first;
-  std::string second;
+  Bigram(WordId f, WordId s) : first(f), second(s) {}
+  WordId first;
+  WordId second;
+  // both ids packed into one word, and back.
+  uint64_t key() const {return ((uint64_t)first << 32) | second;}
+  static Bigram from_key(uint64_t key) {
+    return Bigram(key >> 32, key & 0xffffffff);
+  }
   friend std::ostream& operator<< (std::ostream& os, const Bigram& bg) {
-    os << "(" << bg.first << " " << bg.second << ")";
+    os << "(" << SymbolTable::WORDS.str(bg.first) << " "
+       << SymbolTable::WORDS.str(bg.second) << ")";
     return os;
   }
 };
 
 inline bool operator==(const Bigram& x, const Bigram& y) {
-  if (x.first != y.first) return false;
-  if (x.second != y.second) return false;
-  return true;
+  return (x.first == y.first) && (x.second == y.second);
 }
 
 inline bool operator<(const Bigram& x, const Bigram& y) {
@@ -25,17 +33,20 @@ inline bool operator<(const Bigram& x, const Bigram& y) {
   return false;
 }
 
-//copied from Mark's pair hash
+// hash the packed ids.
 namespace std {
 template <> struct hash<Bigram> {
   size_t operator()(const Bigram& b) const {
-    size_t h1 = hash<std::string>()(b.first);
-    size_t h2 = hash<std::string>()(b.second);
-    return h1 ^ (h1 >> 1) ^ h2 ^ (h2 << 1);
+    return hash<uint64_t>()(b.key());
   }
 };
 }
 
+template <> struct FlatKey<Bigram> {
+  static Bigram empty() {return Bigram(SymbolTable::NONE, SymbolTable::NONE);}
+  static size_t hash(const Bigram& b) {return Rng::mix(b.key());}
+};
+
 struct Trigram {
   Trigram(const std::string& f, const std::string& s, const std::string& t) : 
     first(f), second(s), third(t) {}
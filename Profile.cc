@@ -0,0 +1,78 @@
+#include "Profile.h"
+#include "utils.h"
+
+bool Profile::_enabled = false;
+int64_t Profile::_report_start = 0;
+double Profile::_clock_ns = 0;
+
+static const char* PHASE_NAMES[Profile::NPHASES] =
+  {"other", "sampling", "hyperparameters", "posterior", "io"};
+static const char* STEP_NAMES[Profile::NSTEPS] =
+  {"subtract", "predictive", "tables", "add"};
+static const char* EVENT_NAMES[Profile::NEVENTS] =
+  {"sites", "lookups", "types_created", "types_deleted",
+   "restaurants_created", "allocations"};
+
+// a worker's phase is always OTHER, so only its events and steps
+// are added.
+void
+Profile::Counts::add(const Counts& c) {
+  for (Count e = 0; e < NEVENTS; e++)
+    events[e] += c.events[e];
+  for (Count s = 0; s < NSTEPS; s++) {
+    step_ns[s] += c.step_ns[s];
+    nsteps[s] += c.nsteps[s];
+  }
+  timed_sites += c.timed_sites;
+}
+
+void
+Profile::enable() {
+  _enabled = true;
+  const Count n = 1000;
+  int64_t t = now();
+  for (Count k = 0; k < n; k++)
+    now();
+  _clock_ns = double(now() - t) / (n+1);
+  Counts& c = counts();
+  c = Counts();
+  c.phase_start = _report_start = now();
+}
+
+void
+Profile::report(std::ostream& os, Count iteration) {
+  Counts& c = counts();
+  switch_to(c.phase); // to count the current phase up to now
+  int64_t t = now();
+  resource_usage usage;
+  os << "{\"iteration\": " << iteration
+     << ", \"wall_sec\": " << (t - _report_start) * 1e-9;
+  for (Count p = 0; p < NPHASES; p++)
+    os << ", \"" << PHASE_NAMES[p] << "_sec\": " << c.phase_ns[p] * 1e-9;
+  // the timed boundaries stand for all of them.
+  double scale = c.timed_sites ?
+    double(c.events[SITES]) / c.timed_sites : 0;
+  for (Count s = 0; s < NSTEPS; s++) {
+    double ns = max(c.step_ns[s] - c.nsteps[s] * _clock_ns, 0.0);
+    os << ", \"" << STEP_NAMES[s] << "_sec\": " << ns * 1e-9 * scale;
+  }
+  os << ", \"timed_sites\": " << c.timed_sites;
+  for (Count e = 0; e < NEVENTS; e++)
+    os << ", \"" << EVENT_NAMES[e] << "\": " << c.events[e];
+  if (c.phase_ns[SAMPLING])
+    os << ", \"sites_per_sec\": " << c.events[SITES] / (c.phase_ns[SAMPLING] * 1e-9);
+  os << ", \"user_sec\": " << usage.utime
+     << ", \"system_sec\": " << usage.stime
+     << ", \"rss_mb\": " << usage.rss
+     << ", \"peak_rss_mb\": " << usage.peak_rss << "}" << std::endl;
+  for (Count e = 0; e < NEVENTS; e++)
+    c.events[e] = 0;
+  for (Count p = 0; p < NPHASES; p++)
+    c.phase_ns[p] = 0;
+  for (Count s = 0; s < NSTEPS; s++) {
+    c.step_ns[s] = 0;
+    c.nsteps[s] = 0;
+  }
+  c.timed_sites = 0;
+  _report_start = t;
+}
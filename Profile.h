@@ -0,0 +1,139 @@
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <iostream>
+#include <chrono>
+#include <stdint.h>
+#include "typedefs.h"
+
+/*
+Profile counts and times where a run spends its effort, cheaply
+enough that the hooks are always compiled in.
+
+Events (boundaries sampled, lexicon lookups, word types created and
+deleted, restaurants opened, heap allocations) are counted by
+bumping a thread-local counter, which costs a single add.
+
+Time is split two ways.  The main thread's wall time goes to one
+coarse phase at a time (sampling, hyperparameters, posterior
+evaluation, I/O, or other); a Timer switches phases for its scope,
+and nested Timers give the time back when they end, so the phases
+add up to the wall time.  Within sampling, one boundary in
+SAMPLE_EVERY is timed step by step (subtracting its counts,
+computing the predictive probabilities, sampling tables, adding
+the counts back), and the step times are scaled up by the number
+of boundaries sampled.  Reading the clock only on those boundaries
+keeps the cost down to a counter and a branch per boundary (the
+cost of the reading itself, measured by enable(), is taken off
+each step), and none of this draws random numbers, so a profiled
+run gives the same results as any other.
+
+Worker threads count into their own counters, which
+State::sample_parallel() adds to the main thread's with add().
+report() writes everything since the last report as a JSON line,
+along with the CPU time and memory from /proc/self.
+*/
+
+class Profile {
+public:
+  enum Phase {OTHER, SAMPLING, HYPERPARAMETERS, POSTERIOR, IO, NPHASES};
+  enum Step {SUBTRACT, PREDICTIVE, TABLES, ADD, NSTEPS};
+  enum Event {SITES, LOOKUPS, TYPES_CREATED, TYPES_DELETED,
+	      RESTAURANTS_CREATED, ALLOCATIONS, NEVENTS};
+  // one thread's counts.  plain data, so that a thread's copy is
+  // zeroed without any code running.
+  struct Counts {
+    Count events[NEVENTS];
+    int64_t phase_ns[NPHASES];
+    int64_t step_ns[NSTEPS];
+    Count nsteps[NSTEPS]; // how many times each step was timed
+    Count timed_sites;
+    Count countdown; // boundaries since the last timed one
+    bool timing; // is the current boundary being timed?
+    Step step;
+    int64_t step_start;
+    Phase phase;
+    int64_t phase_start;
+    void add(const Counts& c);
+  };
+  static const Count SAMPLE_EVERY = 64;
+  // the counts of the current thread.
+  static Counts& counts() {
+    static thread_local Counts c;
+    return c;
+  }
+  static void count(Event e, Count n=1) {counts().events[e] += n;}
+  // turns on the timing of boundaries (the coarse phases and the
+  // events are measured anyway), and starts the first report.
+  static void enable();
+  static bool enabled() {return _enabled;}
+  // makes p the current thread's phase, and returns the previous one.
+  static Phase switch_to(Phase p) {
+    Counts& c = counts();
+    int64_t t = now();
+    c.phase_ns[c.phase] += t - c.phase_start;
+    c.phase_start = t;
+    Phase old = c.phase;
+    c.phase = p;
+    return old;
+  }
+  class Timer {
+  public:
+    Timer(Phase p): _saved(switch_to(p)) {}
+    ~Timer() {switch_to(_saved);}
+  private:
+    Phase _saved;
+    Timer(const Timer&);
+    void operator=(const Timer&);
+  };
+  // call at the start of sampling a boundary.  returns true if its
+  // steps are to be timed, the first being SUBTRACT.
+  static bool start_site() {
+    Counts& c = counts();
+    c.events[SITES]++;
+    if (!_enabled || ++c.countdown < SAMPLE_EVERY)
+      return false;
+    c.countdown = 0;
+    c.timed_sites++;
+    c.timing = true;
+    c.step = SUBTRACT;
+    c.step_start = now();
+    return true;
+  }
+  // true if the current boundary is being timed.
+  static bool timing() {return counts().timing;}
+  // on a timed boundary, moves on to step s, and returns the
+  // previous step.
+  static Step step(Step s) {
+    Counts& c = counts();
+    int64_t t = now();
+    c.step_ns[c.step] += t - c.step_start;
+    c.nsteps[c.step]++;
+    c.step_start = t;
+    Step old = c.step;
+    c.step = s;
+    return old;
+  }
+  // on a timed boundary, ends the last step.
+  static void end_site() {
+    Counts& c = counts();
+    c.step_ns[c.step] += now() - c.step_start;
+    c.nsteps[c.step]++;
+    c.timing = false;
+  }
+  // adds a worker's counts to the current thread's.
+  static void add(const Counts& c) {counts().add(c);}
+  // writes the counts and times since the last report (or
+  // enable()) as a JSON line, and starts the next report.
+  static void report(std::ostream& os, Count iteration);
+  static int64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>
+      (std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+private:
+  static bool _enabled;
+  static int64_t _report_start;
+  static double _clock_ns; // what a reading of the clock costs
+};
+
+#endif
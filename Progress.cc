@@ -0,0 +1,57 @@
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include "Progress.h"
+
+Progress::Progress(ostream* os, const string& status, Float interval,
+		   const Corpus& corpus, Count start, Count iters):
+  _os(os), _status(status), _interval(interval * 1e9),
+  _nutterances(corpus.size()), _nboundaries(corpus.nchars() - corpus.size()),
+  _iters(iters), _last_done(start), _last(Profile::now()) {}
+
+// h:mm:ss
+static string
+duration(double seconds) {
+  long s = long(seconds + .5);
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%ld:%02ld:%02ld", s/3600, s/60%60, s%60);
+  return buf;
+}
+
+void
+Progress::report(Count done, Count stage, Count nstages, Float temp) {
+  int64_t t = Profile::now();
+  double seconds = (t - _last) * 1e-9;
+  Count sweeps = done - _last_done;
+  double per_sweep = sweeps ? seconds / sweeps : 0;
+  double left = per_sweep * (_iters - done);
+  time_t end = time(0) + time_t(left + .5);
+  char at[32];
+  strftime(at, sizeof(at), "%Y-%m-%d %H:%M:%S", localtime(&end));
+  ostringstream line;
+  line << "iter " << done << "/" << _iters << ", ";
+  if (nstages)
+    line << "stage " << stage << "/" << nstages << " (temp " << temp << ")";
+  else
+    line << "temp " << temp;
+  line << fixed << setprecision(0)
+       << ", " << sweeps * _nboundaries / seconds << " boundaries/sec, "
+       << sweeps * _nutterances / seconds << " utts/sec, "
+       << setprecision(3) << per_sweep << " sec/sweep, "
+       << duration(left) << " left, done at " << at << endl;
+  if (_os)
+    *_os << line.str() << flush;
+  // replaced in one step, so a reader never sees half a report.
+  if (!_status.empty()) {
+    string tmp = _status + ".tmp";
+    {
+      ofstream os(tmp.c_str());
+      os << line.str();
+    }
+    rename(tmp.c_str(), _status.c_str());
+  }
+  _last = t;
+  _last_done = done;
+}
@@ -0,0 +1,57 @@
+#ifndef _PROGRESS_H_
+#define _PROGRESS_H_
+
+#include <iostream>
+#include <string>
+#include <stdint.h>
+#include "typedefs.h"
+#include "Corpus.h"
+#include "Profile.h"
+
+/*
+Progress tells how a long run is going: every interval seconds of
+wall time it reports the iteration, the annealing stage, the
+boundaries and utterances sampled per second, the seconds per
+sweep, and how long the rest of the run will take at the rate
+since the last report.  The rates come from the size of the corpus
+(every boundary but the last of each utterance is resampled once
+a sweep) and the clock, so a report costs nothing like a
+log_posterior().  The clock is only read between sweeps, so a
+report can't come in the middle of one.
+
+Reports go to a stream, or to a status file, which is replaced by
+each new report so that it always holds the latest one.
+*/
+
+class Progress {
+public:
+  // reports to os, unless it is null, and to the file status,
+  // unless it is empty.  the run is to do iters sweeps, from start.
+  Progress(ostream* os, const string& status, Float interval,
+	   const Corpus& corpus, Count start, Count iters);
+  // call after each sweep, with the number of sweeps done so far.
+  // stage is the annealing step (of nstages) whose temperature is
+  // temp, with nstages = 0 if the temperature is fixed.
+  void sweep(Count done, Count stage, Count nstages, Float temp) {
+    if (Profile::now() - _last >= _interval)
+      report(done, stage, nstages, temp);
+  }
+  // the same, at the end of the run: reports unless the last
+  // report was at done.
+  void finish(Count done, Count stage, Count nstages, Float temp) {
+    if (done != _last_done)
+      report(done, stage, nstages, temp);
+  }
+private:
+  ostream* _os;
+  string _status;
+  int64_t _interval; // ns
+  Count _nutterances;
+  Count _nboundaries; // sampled per sweep
+  Count _iters;
+  Count _last_done; // sweeps done at the last report
+  int64_t _last; // time of the last report
+  void report(Count done, Count stage, Count nstages, Float temp);
+};
+
+#endif
@@ -1,71 +1,138 @@
+#include <algorithm>
 #include "Restaurant.h"
-#include "State.h"
-#include "Urn.h"
 #include "utils.h"
 
 extern Count debug_level;
 
-const State* Restaurant::STATE = 0;
-//Urn<Label, Float> Restaurant::_samples;
+Restaurant&
+Restaurant::operator=(const Restaurant& r) {
+  if (this == &r) return *this;
+  _ntokens = r._ntokens;
+  _ntables = r._ntables;
+  _nsizes = r._nsizes;
+  std::copy(r._sizes, r._sizes + NSIZES, _sizes);
+  delete _dense;
+  _dense = r._dense ? new Cs(*r._dense) : 0;
+  return *this;
+}
+
+Restaurant&
+Restaurant::operator=(Restaurant&& r) {
+  if (this == &r) return *this;
+  _ntokens = r._ntokens;
+  _ntables = r._ntables;
+  _nsizes = r._nsizes;
+  std::copy(r._sizes, r._sizes + NSIZES, _sizes);
+  std::swap(_dense, r._dense);
+  return *this;
+}
+
+void
+Restaurant::save(Checkpoint& c) const {
+  c.put(_ntokens);
+  c.put(_ntables);
+  c.put(_nsizes);
+  c.put(_sizes);
+  c.put(_dense != 0);
+  if (_dense)
+    c.put(*_dense);
+}
 
-//1.  Number of tables and tokens is consistent
-//2.  Max index of occupied tables <= # tables + free list size -1
-//3.  Max index of (occupied tables and free list) 
-//    equals (# tables + free list size -1)
-//4.  Indices in free list are not used in occupied tables
-//5.  Exactly all indices from 0 .. (#tables + free list size -1)
-//    are either occupied or in free list.
-void 
+void
+Restaurant::restore(Checkpoint& c) {
+  c.get(_ntokens);
+  c.get(_ntables);
+  c.get(_nsizes);
+  c.get(_sizes);
+  bool dense;
+  c.get(dense);
+  delete _dense;
+  _dense = 0;
+  if (dense) {
+    _dense = new Cs;
+    c.get(*_dense);
+  }
+}
+
+//1.  Number of tables and tokens is consistent with the histogram
+//2.  Sparse sizes are distinct and nonzero, with nonzero counts
+void
 Restaurant::check_invariant() const {
 #ifndef NDEBUG
-  my_assert(_ntables == _tables.size(), CC(_ntables, _tables.size())); //1
-  Count total = 0;
-  if ((_ntables == 0)  && (_free_list.size() == 0))
+  Count tables = 0;
+  Count tokens = 0;
+  for (Count i = 0; i < nslots(); i++) {
+    tables += slot_ntables(i);
+    tokens += slot_size(i) * slot_ntables(i);
+  }
+  my_assert(tables == _ntables, CC(tables, _ntables)); //1
+  my_assert(tokens == _ntokens, CC(tokens, _ntokens)); //1
+  if (!_dense) {
+    for (Count i = 0; i < _nsizes; i++) {
+      my_assert(_sizes[i].size > 0 && _sizes[i].ntables > 0, *this); //2
+      for (Count j = 0; j < i; j++)
+	my_assert(_sizes[i].size != _sizes[j].size, *this); //2
+    }
+  }
+  else
+    my_assert(_dense->empty() || (*_dense)[0] == 0, *this);
+#endif
+}
+
+Count
+Restaurant::ntables(Count k) const {
+  if (_dense)
+    return k < _dense->size() ? (*_dense)[k] : 0;
+  for (Count i = 0; i < _nsizes; i++) {
+    if (_sizes[i].size == k)
+      return _sizes[i].ntables;
+  }
+  return 0;
+}
+
+void
+Restaurant::add_tables(Count k, int n) {
+  if (_dense) {
+    if (k >= _dense->size())
+      _dense->resize(k+1, 0);
+    (*_dense)[k] += n;
     return;
-  Bs ok(_ntables + _free_list.size() -1, false);
-  Count max_index = 0;
-  cforeach (Tables, t, _tables) {
-      total += t->second;
-      ok[t->first] = true;
-      if (t->first > max_index) max_index = t->first;
+  }
+  for (Count i = 0; i < _nsizes; i++) {
+    if (_sizes[i].size == k) {
+      _sizes[i].ntables += n;
+      if (_sizes[i].ntables == 0)
+	_sizes[i] = _sizes[--_nsizes];
+      return;
     }
-  my_assert(_ntokens == total, CC(_ntokens, total)); //1
-  my_assert(max_index <= _ntables +_free_list.size()-1, *this); //2
-  cforeach (Indices, i, _free_list) {
-    my_assert(_tables.find(*i) == _tables.end(),*this); //4
-    ok[*i] = true;
-    if (*i > max_index) max_index = *i;
   }
-  my_assert(max_index == _ntables +_free_list.size()-1, *this); //3
-  for (Count i = 0; i < ok.size(); i++) { //5
-    my_assert(ok[i], *this);
+  my_assert(n > 0, *this);
+  if (_nsizes < NSIZES) {
+    _sizes[_nsizes].size = k;
+    _sizes[_nsizes].ntables = n;
+    _nsizes++;
+    return;
   }
-#endif
+  // out of room: switch to the dense histogram for good.
+  Count max_size = k;
+  for (Count i = 0; i < _nsizes; i++)
+    max_size = max(max_size, (Count)_sizes[i].size);
+  _dense = new Cs(max_size+1, 0);
+  for (Count i = 0; i < _nsizes; i++)
+    (*_dense)[_sizes[i].size] = _sizes[i].ntables;
+  (*_dense)[k] += n;
+  _nsizes = 0;
 }
 
-//add token to table i, return true if i is a new table.
-//if "unsafe", doesn't do most assertion checks even when debugging
-//mode is on. this is needed for computing log posterior, b/c
-//tables must be incremented out of order.
-//DON'T USE "UNSAFE" OTHERWISE!
-bool 
-  Restaurant::inc_table(Count i, bool unsafe) {
+bool
+Restaurant::inc_table(Count k) {
   debug_output(1100, "Restaurant::inc_table() ", *this);
-  if (!unsafe) {
-    my_assert(i <= (_ntables + _free_list.size()), i); //note: some values that pass this may still be invalid.
-    check_invariant();
-  }
- if (!_free_list.empty() && (i == _free_list.back())) {
-    my_assert(_tables.find(i) == _tables.end(), *(_tables.find(i)));
-    _tables.insert(CC(i,0));
-    _free_list.pop_back();
- }  
- else if (i == _ntables) {
-    _tables.insert(CC(i, 0));
- }
-  _tables[i]++;
+  my_assert(k == 0 || ntables(k) > 0, k);
   _ntokens++;
-  if (_tables[i] == 1) {
+  if (k > 0)
+    add_tables(k, -1);
+  add_tables(k+1, 1);
+  if (k == 0) {
     _ntables++;
     debug_output(1200, "after Restaurant::inc_table(1) ", *this);
     return true;
@@ -74,44 +141,92 @@ bool
   return false;
 }
 
-
-// removes a token, decrementing table count if needed.
-// returns true if table became empty
-bool 
-Restaurant::dec_table(Count i) {
+bool
+Restaurant::dec_table(Count k) {
   debug_output(1100, "Restaurant::dec_table() ", *this);
-  my_assert(_tables.find(i) != _tables.end(), i);
-  _tables[i]--;
+  my_assert(k > 0 && ntables(k) > 0, k);
   _ntokens--;
-  if (_tables[i] == 0) {
+  add_tables(k, -1);
+  if (k == 1) {
     _ntables--;
-    _tables.erase(i);
-    _free_list.push_back(i);
     debug_output(1200, "after Restaurant::dec_table(1) ", *this);
     return true;
   }
+  add_tables(k-1, 1);
   debug_output(1200, "after Restaurant::dec_table(2) ", *this);
   return false;
 }
 
-// returns the index of a table according to CRP distrib.
-// index is between 0 and _ntables, where the latter
-// indicates a new table.
+// each table is chosen with weight (ntokens)^temp, and a new
+// table with weight p_new^temp.  when annealing, the weights of
+// the sizes in use are kept from the first pass for the second,
+// so each pow() is done once; without it they are cheaper to
+// recompute than to keep.
 Count
-Restaurant::sample_table(Float temp) const {
-  //  cout << "random" << endl;
-  check_invariant();
+Restaurant::sample_table(Float p_new, Float temp) const {
   if (_ntables == 0)
-    return next_empty();
-  Urn<Count, Float> new_tables;
-  new_tables.reserve(_ntables+1);
-  cforeach (Tables, t, _tables) {
-    new_tables.push(t->first,pow(t->second,temp));
+    return 0;
+  if (temp == 1) {
+    Float total = p_new;
+    for (Count i = 0; i < nslots(); i++) {
+      if (slot_ntables(i) == 0) continue;
+      total += slot_ntables(i) * (Float)slot_size(i);
+    }
+    Float r = randd() * total;
+    for (Count i = 0; i < nslots(); i++) {
+      if (slot_ntables(i) == 0) continue;
+      r -= slot_ntables(i) * (Float)slot_size(i);
+      if (r < 0)
+	return slot_size(i);
+    }
+    return 0;
+  }
+  static thread_local vector<pair<Count, Float> > weights;
+  weights.clear();
+  Float total = pow(p_new, temp);
+  for (Count i = 0; i < nslots(); i++) {
+    if (slot_ntables(i) == 0) continue;
+    Float w = slot_ntables(i) * pow(slot_size(i), temp);
+    weights.push_back(make_pair(slot_size(i), w));
+    total += w;
+  }
+  Float r = randd() * total;
+  for (Count i = 0; i < weights.size(); i++) {
+    r -= weights[i].second;
+    if (r < 0)
+      return weights[i].first;
   }
-  CF p(next_empty(),pow(STATE->p_word(_label),temp));
-  new_tables.push(p);
-  debug_output(700, "Restaurant::random_table() weights ", new_tables);
-  Count t = new_tables.draw();
-  return t;
+  return 0;
 }
 
+Count
+Restaurant::sample_token() const {
+  my_assert(_ntokens > 0, *this);
+  Float r = randd() * _ntokens;
+  Count k = 0;
+  for (Count i = 0; i < nslots(); i++) {
+    if (slot_ntables(i) == 0) continue;
+    k = slot_size(i);
+    r -= slot_ntables(i) * k;
+    if (r < 0)
+      break;
+  }
+  return k;
+}
+
+Count
+Restaurant::fill_size(Count m) const {
+  vector<pair<Count, Count> > sizes;
+  for (Count i = 0; i < nslots(); i++) {
+    if (slot_ntables(i))
+      sizes.push_back(make_pair(slot_size(i), slot_ntables(i)));
+  }
+  sort(sizes.rbegin(), sizes.rend());
+  for (Count i = 0; i < sizes.size(); i++) {
+    Count n = sizes[i].first * sizes[i].second;
+    if (m < n)
+      return m % sizes[i].first;
+    m -= n;
+  }
+  return 0;
+}
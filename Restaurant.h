@@ -2,80 +2,93 @@
 #define _RESTAURANT_H_
 
 #include <iostream>
+#include <stdint.h>
 #include "utils.h"
 #include "typedefs.h"
-#include "Urn.h"
+#include "Checkpoint.h"
 
 /*
-Restaurant represents a lexical item and keeps track of
-the number of tables and how many tokens are on each.
-Tables are implemented as a hash Count->Count where
-the keys are table indices.  When a table is emptied,
-its index is stored in a list for reuse.
+Restaurant keeps track of the tables of a single bigram and how
+many tokens are on each.  The tokens at a table are exchangeable,
+so we do not record which table each token sits at, only how many
+tables there are of each size: a token is seated at (or removed
+from) "a table with k tokens" rather than a numbered table.
+Most restaurants have tables of only one or two sizes, so the
+histogram is kept as a few (size, number of tables) pairs inside
+the object; a restaurant that needs more switches to a dense
+vector indexed by size.  Either way seating and unseating never
+allocate, except when the dense vector grows.
 */
 
-class State;
-class BiLexicon;
-//typedef ext::hash_map<Count, Count> Tables;
-typedef unordered_map<Count, Count> Tables;
-//typedef Urn<Sample, Float> Samples;
-
 class Restaurant {
 public:
-  static const State* STATE;
-  Restaurant(Bigram label, const State* state):
-    _label(label), _ntokens(0), _ntables(0) {
-    STATE = state;}
-  Restaurant(Bigram label): _label(label), _ntokens(0), _ntables(0) {
-    my_assert(STATE,*this);}
-  virtual ~Restaurant() {}
+  Restaurant(): _ntokens(0), _ntables(0), _nsizes(0), _dense(0) {}
+  Restaurant(const Restaurant& r): _dense(0) {*this = r;}
+  Restaurant(Restaurant&& r): _dense(0) {*this = std::move(r);}
+  Restaurant& operator=(const Restaurant& r);
+  Restaurant& operator=(Restaurant&& r);
+  ~Restaurant() {delete _dense;}
   void check_invariant() const;
   bool empty() const {
     if (!_ntables) return true;
     return false;
   }
-  const Bigram& label() const {return _label;}
   Count ntokens() const {return _ntokens;}
-  //num of tokens at table i
-  Count ntokens(Count i) const {
-    Tables::const_iterator iter = _tables.find(i);
-    if (iter == _tables.end())
-      return 0;
-    return iter->second;
-  }
   Count ntables() const {return _ntables;}
-  //add token to table i, return true if i is a new table
-  // i can be up to (current final index + 1)
-  // set unsafe->true only in log posterior when tables may be incr'd out of order.
-  bool inc_table(Count i, bool unsafe=false);
-  // removes a token, decrementing table count if needed.
-  // returns true if table became empty
-  bool dec_table(Count i);
-  // old_table indicates a table whose count must be subtracted,
-  // -1 if counts are all correct.
-  Count sample_table(Float temp) const;
+  //num of tables with k tokens
+  Count ntables(Count k) const;
+  //add token to a table with k tokens (k = 0 for a new table).
+  //return true if it is a new table.
+  bool inc_table(Count k);
+  //remove a token from a table with k tokens.
+  //return true if the table became empty.
+  bool dec_table(Count k);
+  //size of the table a new token joins under the CRP (0 for a new
+  //table), where p_new is the weight of a new table.
+  Count sample_table(Float p_new, Float temp) const;
+  //size of the table of a token chosen uniformly at random.
+  Count sample_token() const;
+  //size of the table that token m+1 joins if the tables are
+  //filled one at a time, largest first (0 for a new table).
+  Count fill_size(Count m) const;
+  //log of the product over tables of (ntokens-1)!: the seating
+  //term of the joint prob of the tables' assignments.
+  Float log_seating() const {
+    Float log_p = 0;
+    for (Count i = 0; i < nslots(); i++)
+      log_p += slot_ntables(i) * lgamma(slot_size(i));
+    return log_p;
+  }
+  void save(Checkpoint& c) const;
+  void restore(Checkpoint& c);
   friend ostream& operator<< (ostream& os, const Restaurant& r) {
-    //    if (r.empty()) return os;
-    os << r._label << " [ty=" << r._ntokens << ", to="
-       << r._ntables << "]" << " " << r._tables
-       << " free: " << r._free_list;
+    os << "[ty=" << r._ntokens << ", to=" << r._ntables << "]";
+    for (Count i = 0; i < r.nslots(); i++) {
+      if (r.slot_ntables(i))
+	os << " " << r.slot_ntables(i) << "x" << r.slot_size(i);
+    }
     return os;
   }
 private:
-  typedef Cs Indices;
-  Bigram _label; // what bigram we correspond to
-  Tables _tables; // number of tokens at each table
-  Count _ntokens; // total number of tokens at all tables
-  Count _ntables; // number of occupied tables
-  Indices _free_list; // indices of free tables
-  //  static Urn<Label, Float> _samples;
-  const Tables& tables() const {return _tables;}
-  // returns index of next free table
-  Count next_empty() const {
-    if (!_free_list.empty()) 
-      return _free_list.back();
-    return _ntables;
+  struct Size {
+    uint32_t size;
+    uint32_t ntables;
+  };
+  static const Count NSIZES = 3;
+  uint32_t _ntokens; // total number of tokens at all tables
+  uint32_t _ntables; // number of occupied tables
+  uint32_t _nsizes; // number of distinct sizes in _sizes
+  Size _sizes[NSIZES]; // in no particular order; unused once _dense is set
+  Cs* _dense; // number of tables of each size
+  // the histogram, as slots of (size, number of tables).
+  // dense slots may have no tables.
+  Count nslots() const {return _dense ? _dense->size() : _nsizes;}
+  Count slot_size(Count i) const {return _dense ? i : _sizes[i].size;}
+  Count slot_ntables(Count i) const {
+    return _dense ? (*_dense)[i] : _sizes[i].ntables;
   }
+  // adds n (1 or -1) tables with k tokens.
+  void add_tables(Count k, int n);
 };
 
 #endif
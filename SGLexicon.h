@@ -6,38 +6,35 @@
 #include <utility>
 #include <vector>
 #include "utils.h"
-#include <unordered_map>
+#include "FlatMap.h"
+#include "Checkpoint.h"
 
-
-#ifndef EXT_NAMESPACE
-#define EXT_NAMESPACE __gnu_cxx
-#endif
-
-namespace ext = EXT_NAMESPACE;
-
-//key_type must have ==, <, and hash()
-// (defined for most standard classes in Mark's utils.h)
-// this base class assumes that datatype is numeric,
-// although redefining inc and dec can change that.
+// a count for each key, and the total of the counts.  key_type
+// must have ==, < and a FlatKey<key_type> (see FlatMap.h); the
+// key FlatKey<key_type>::empty() may not be counted.
+// data_type must have ==, <, >, +=, and -= (i.e. numeric).
+// a key whose count drops to 0 is removed.
+//
+// the counts are kept in a FlatMap, so inc() and dec() each find
+// (or insert) the key with one probe.  nothing is virtual; a class
+// that counts differently (like BiLexicon) has its own type.
 template <typename key_type, typename data_type>
-class SGLexiconBase: public std::unordered_map<key_type, data_type> {
+class SGLexicon {
+  typedef FlatMap<key_type, data_type> Map;
   typedef typename std::pair<data_type, data_type> dd_t;
-  typedef typename std::unordered_map<typename SGLexiconBase::key_type, data_type> parent_t;
 public:
-  typedef typename std::pair<typename SGLexiconBase::key_type, data_type> value_type;
-  typedef typename std::unordered_map<typename SGLexiconBase::key_type, data_type>::iterator iterator;
-  typedef typename std::unordered_map<typename SGLexiconBase::key_type, data_type>::const_iterator const_iterator;
+  typedef typename std::pair<key_type, data_type> value_type;
+  typedef typename Map::iterator iterator;
+  typedef typename Map::const_iterator const_iterator;
   typedef typename std::vector<value_type> LexVector;
   typedef typename std::vector<value_type>::iterator LexVectorIter;
   typedef typename std::vector<value_type>::const_iterator LexVectorCIter;
-  SGLexiconBase() : _ntokens(0) {}
-  virtual ~SGLexiconBase() {}
-  //don't know why I need these 4 in order to compile...
-  virtual iterator begin() {return parent_t::begin();}
-  virtual const_iterator begin() const {return parent_t::begin();}
-  virtual iterator end() {return parent_t::end();}
-  virtual const_iterator end() const {return parent_t::end();}
-  virtual void check_invariant() const {
+  SGLexicon() : _ntokens(0) {}
+  iterator begin() {return _counts.begin();}
+  const_iterator begin() const {return _counts.begin();}
+  iterator end() {return _counts.end();}
+  const_iterator end() const {return _counts.end();}
+  void check_invariant() const {
 #ifndef NDEBUG
     data_type total(0);
     for (const_iterator i=begin(); i != end(); i++) {
@@ -47,71 +44,85 @@ public:
     my_assert((total == _ntokens), dd_t(total, _ntokens));
 #endif
   }
-  virtual void clear() {
-    parent_t::clear();
+  void clear() {
+    _counts.clear();
     _ntokens = 0;
   }
-  virtual size_t mem_size() {return parent_t::size();}
-  virtual data_type ntokens() const {return _ntokens;}
-  virtual size_t ntypes() const {return parent_t::size();}
-  virtual data_type operator()(const typename SGLexiconBase::key_type& s) const {
-    const_iterator i = this->find(s);
+  // key_type and data_type must be plain data to checkpoint.
+  void save(Checkpoint& c) const {
+    c.put(_counts.slots());
+    c.put(_ntokens);
+  }
+  void restore(Checkpoint& c) {
+    std::vector<typename Map::Slot> slots;
+    c.get(slots);
+    _counts.assign(slots);
+    c.get(_ntokens);
+  }
+  // bytes used by the table (not by the keys' own storage).
+  size_t memory() const {return _counts.memory();}
+  data_type ntokens() const {return _ntokens;}
+  size_t ntypes() const {return _counts.size();}
+  data_type operator()(const key_type& s) const {
+    const_iterator i = _counts.find(s);
     if (i == end()) return 0;
     return i->second;
   }
-  // return true if a new type was added
-  // Unless redefined in subcalss, return value is 0/1 only.
-  virtual size_t inc(const typename SGLexiconBase::key_type& s) {
-    _ntokens++;
-    if (this->find(s) != end()) {
-      (*this)[s]++;
-      return 0;
-    }
-    parent_t::insert(std::pair<typename SGLexiconBase::key_type, data_type>(s,1));
-    return 1;
+  // 1 if s has been counted, else 0.
+  size_t count(const key_type& s) const {
+    return _counts.find(s) != end();
+  }
+  // adds count to s.  returns 1 if a new type was added, else 0.
+  size_t inc(const key_type& s, data_type count=1) {
+    _ntokens += count;
+    std::pair<iterator, bool> i = _counts.insert(s);
+    i.first->second += count;
+    return i.second;
   }
-  //return true if a type was deleted
-  virtual size_t dec(const typename SGLexiconBase::key_type& s) {
-    (*this)[s]--;
-    my_assert((*this)[s] >= 0, value_type(s,(*this)[s]));
-    _ntokens--;
-    if ((*this)[s] == 0) {
-      this->erase(s);
+  // takes count from s.  returns 1 if a type was deleted, else 0.
+  size_t dec(const key_type& s, data_type count=1) {
+    iterator i = _counts.find(s);
+    my_assert(i != end(), s);
+    i->second -= count;
+    my_assert(i->second >= 0, value_type(s, i->second));
+    _ntokens -= count;
+    if (i->second == 0) {
+      _counts.erase(i);
       return 1;
     }
     return 0;
   }
-  virtual LexVector sort_by_key() const{
+  LexVector sort_by_key() const{
     LexVector counts;
     for (const_iterator i=begin(); i != end(); i++) {
-      counts.push_back(value_type(*i));
+      counts.push_back(value_type(i->first, i->second));
     }
     sort(counts.begin(), counts.end(), first_lessthan());
     return counts;
   }
-  virtual LexVector sort_by_value() const{
+  LexVector sort_by_value() const{
     LexVector counts;
     for (const_iterator i=begin(); i != end(); i++) {
-      counts.push_back(value_type(*i));
+      counts.push_back(value_type(i->first, i->second));
     }
     sort(counts.begin(), counts.end(), second_lessthan());
     return counts;
   }
-  virtual void print_by_key(std::ostream& os=std::cout) const {
+  void print_by_key(std::ostream& os=std::cout) const {
     LexVector l = sort_by_key();
     for (LexVectorIter i=l.begin(); i != l.end(); i++) {
       os << *i << std::endl;
     }
     os << std::endl;
   }
-  virtual void print_by_value(std::ostream& os=std::cout) const {
+  void print_by_value(std::ostream& os=std::cout) const {
     LexVector l = sort_by_value();
     for (LexVectorIter i=l.begin(); i != l.end(); i++) {
       os << *i << std::endl;
     }
     os << std::endl;
   }
-  friend std::ostream& operator<< (std::ostream& os, const SGLexiconBase& lexicon) {
+  friend std::ostream& operator<< (std::ostream& os, const SGLexicon& lexicon) {
     for (const_iterator iter = lexicon.begin(); iter != lexicon.end(); iter++) {
       os << iter->first << " " << iter->second << std::endl;
     }
@@ -119,13 +130,9 @@ public:
     os << "Total lexicon types: " << lexicon.ntypes() << std::endl;
     return os;
   }
-protected:
+private:
+  Map _counts;
   data_type _ntokens;
-  // don't accidentally use these from outside
-  virtual data_type& operator[](const typename SGLexiconBase::key_type& s) {
-    return parent_t::operator[](s);}
-  virtual size_t size() {
-    return parent_t::size();} 
 
   struct first_lessthan {
     template <typename T1, typename T2>
@@ -133,57 +140,15 @@ protected:
       return e1.first < e2.first;
     }
   };
+  // keys with equal counts by key, as the table's order isn't fixed.
   struct second_lessthan {
     template <typename T1, typename T2>
     bool operator() (const T1& e1, const T2& e2) {
-      return e1.second < e2.second;
+      if (e1.second != e2.second)
+	return e1.second < e2.second;
+      return e1.first < e2.first;
     }
   };
 };
 
-// The only difference between this and base class is
-// that here we can increment by more than 1 at a time.
-//data_type must have ==, <, >, +=, and -= (i.e. numeric)
-template <typename key_type, typename data_type>
-class SGLexicon: public SGLexiconBase<key_type, data_type> {
-  typedef SGLexiconBase<typename SGLexicon::key_type, data_type> parent_t;
-public:
-  typedef typename std::pair<typename SGLexicon::key_type, data_type> value_type;
-  typedef typename std::unordered_map<typename SGLexicon::key_type, data_type>::iterator iterator;
-  typedef typename std::unordered_map<typename SGLexicon::key_type, data_type>::const_iterator const_iterator;
-  SGLexicon() {}
-  virtual ~SGLexicon() {}
-  //don't know why I need these 4 in order to compile...
-  virtual iterator begin() {return parent_t::begin();}
-  virtual const_iterator begin() const {return parent_t::begin();}
-  virtual iterator end() {return parent_t::end();}
-  virtual const_iterator end() const {return parent_t::end();}
-  void test_function() {std::cout << "got the function"  <<std::endl;}
-  virtual size_t inc(const typename SGLexicon::key_type& s) {
-    return parent_t::inc(s);  }
-  virtual size_t dec(const typename SGLexicon::key_type& s) {
-    return parent_t::dec(s);  }
-  //return 1 if a new type was added, else 0.
-  virtual size_t inc(const typename SGLexicon::key_type& s, data_type count) {
-    parent_t::_ntokens += count;
-    if (this->find(s) != end()) {
-      (*this)[s] += count;
-      return 0;
-    }
-    parent_t::insert(std::pair<typename SGLexicon::key_type, data_type>(s,count));
-    return 1;
-  }
-  //return true if a type was deleted
-  virtual size_t dec(const typename SGLexicon::key_type& s, data_type count) {
-    (*this)[s] -= count;
-    my_assert((*this)[s] >= 0, value_type(s,(*this)[s]));
-    parent_t::_ntokens -= count;
-    if ((*this)[s] == 0) {
-      this->erase(s);
-      return 1;
-    }
-    return 0;
-  }
-};
-
 #endif
@@ -4,7 +4,7 @@
 using namespace std;
 
 void
-Scoring::score_utterance(Utterance* utterance)
+Scoring::score_utterance(const Utterance* utterance)
 {
   _utterances++;
   add_words_to_lexicon(utterance->get_segmented_words(),
@@ -13,13 +13,11 @@ Scoring::score_utterance(Utterance* utterance)
 		       _reference_lex);
   // calculate number of correct words, segmented words,
   // and reference words and add to totals
-  string segmented = utterance->get_segmented();
-  string reference = utterance->get_reference();
-  string::const_iterator s = segmented.begin();
-  string::const_iterator r = reference.begin();
   bool left_match = 1;
-  while (s != segmented.end()) {
-    if ((*s == SENTINEL) && (*r == SENTINEL)) {
+  for (Count i = 0; i < utterance->length(); i++) {
+    bool s = utterance->boundary(i);
+    bool r = utterance->reference_boundary(i);
+    if (s && r) {
       _bs_correct++;
       _segmented_bs++;
       _reference_bs++;
@@ -29,24 +27,16 @@ Scoring::score_utterance(Utterance* utterance)
       left_match = 1;
       _segmented_words++;
       _reference_words++;
-      s++;
-      r++;
     }
-    else if (*s == SENTINEL) {
+    else if (s) {
       _segmented_words++;
       _segmented_bs++;
       left_match = 0;
-      s++;
     }
-    else if (*r == SENTINEL) {
+    else if (r) {
       _reference_words++;
       _reference_bs++;
       left_match = 0;
-      r++;
-    }
-    else {
-      s++;
-      r++;
     }
   }
   //subtract right utt boundary
@@ -146,15 +136,14 @@ Scoring::print_reference_lexicon(ostream& os) const
 void
 Scoring::print_lexicon(const Lexicon& lexicon, ostream& os) const
 {
-  //  Cs length_counts(Utterance::MAX_LENGTH, 0);
   vector<SC> word_counts;
   Count tot = 0;
   cforeach(Lexicon, iter, lexicon) {
-    word_counts.push_back(SC(*iter));
+    word_counts.push_back(SC(iter->first, iter->second));
     tot += iter->second;
   }
   sort(word_counts.begin(), word_counts.end(),
-       second_greaterthan());
+       second_greaterthan_first_lessthan());
   foreach(vector<SC>, iter, word_counts) {
     if (_reference_lex.count(iter->first))
       os << "+ ";
@@ -168,10 +157,14 @@ Scoring::print_lexicon(const Lexicon& lexicon, ostream& os) const
 void
 Scoring::print_lexicon_summary(const Lexicon& lexicon, ostream& os) const
 {
-  Cs length_counts(Utterance::MAX_LENGTH, 0);
-  Cs length_types(Utterance::MAX_LENGTH, 0);
+  Cs length_counts;
+  Cs length_types;
   Count tot = 0;
   cforeach(Lexicon, iter, lexicon) {
+    if (iter->first.length() >= length_counts.size()) {
+      length_counts.resize(iter->first.length()+1, 0);
+      length_types.resize(iter->first.length()+1, 0);
+    }
     length_counts[iter->first.length()] += iter->second;
     tot += iter->second;
     length_types[iter->first.length()]++;
@@ -20,7 +20,7 @@ public:
   // find correct, segmented, and reference words
   // for utterance and add to totals. Add words
   // to seg lexicon.
-  void score_utterance(Utterance* utterance);
+  void score_utterance(const Utterance* utterance);
   double precision() const {
     return (double)_words_correct/_segmented_words;}
   double recall() const {
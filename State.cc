@@ -1,3 +1,4 @@
+#include <chrono>
 #include "State.h"
 #include "Urn.h"
 
@@ -7,17 +8,24 @@ extern Count debug_level;
 int State::_unigram_model = -1;
 int State::_bigram_model = -1;
 int State::_ngram = -1;
+int State::_sampler = State::SINGLE;
+Count State::_max_word_length = 0;
+Count State::_nthreads = 1;
+Count State::_sync_interval = 0;
+Count State::_nshards = 1;
+State::Sweep State::_sweep = 0;
 Float State::_noise = -1;
  Float State::_alpha = -1;
  Float State::_alpha1 = -1;
  Float State::_p_boundary = -1;
  Float State::_p_utt_boundary = -1;
  PhoneProbs State::_phoneme_ps;
- WordProbs State::_true_word_ps;
- BigramProbs State::_true_bg_ps;
-StringLexicon State::_true_nfollow;
-
-typedef pair<Bigram, Float> BiF;
+vector<State::CachedProb> State::_p_word_cache;
+Count State::_p_word_epoch = 1;
+Count State::_p_word_hits = 0;
+Count State::_p_word_misses = 0;
+Fs State::_log_phoneme_ps(256, 0);
+Fs State::_log_length_ps;
 
 void
 State::set_models(string uni_model, string bi_model, int ngram, Float noise) {
@@ -62,16 +70,44 @@ State::set_models(string uni_model, string bi_model, int ngram, Float noise) {
   }
 }
 
+void
+State::set_sampler(string sampler, Count max_length) {
+  _max_word_length = max_length;
+  if (sampler == "single")
+    _sampler = SINGLE;
+  else if (sampler == "block") {
+    if (_ngram != 1)
+      error("the blocked sampler is only implemented for the unigram model\n");
+    _sampler = BLOCK;
+  }
+  else if (sampler == "type") {
+    if (_ngram != 1)
+      error("the type-based sampler is only implemented for the unigram model\n");
+    _sampler = TYPE;
+  }
+  else 
+    error("unknown sampler\n");
+}
+
+void
+State::set_threads(Count nthreads, Count sync_interval, Count nshards) {
+  _nthreads = max(nthreads, (Count)1);
+  _sync_interval = sync_interval;
+  _nshards = nshards ? nshards : _nthreads;
+  if (_nshards > 1 && (_ngram != 1 || _sampler != SINGLE))
+    error("parallel sampling is only implemented for the single-site unigram sampler\n");
+}
+
 //alpha is the Dirichlet hyperparam, b is the prior prob. of a boundary.
 //alpha1 is the bigram Dirichlet, p_utt_b is prior prob of utt boundary.
 State::State(DatafileBase* data, Float alpha, Float b, Float alpha1, Float p_utt_b):
-  _nutterances(0),
-  _bg_counts(this) {
+  _nutterances(0) {
   _alpha = alpha;
   _alpha1 = alpha1;
   _p_boundary = b;
   _p_utt_boundary = p_utt_b;
   my_assert((_p_boundary > 0) && (_p_boundary <=1), _p_boundary);
+  _sweep = choose_sweep();
   //  _bg_counts.set_min_table_count(_alpha1);
   assert((_unigram_model >= MONKEYS) && 
 	 (_bigram_model >= MONKEYS) && 
@@ -107,138 +143,353 @@ State::State(DatafileBase* data, Float alpha, Float b, Float alpha1, Float p_utt
     cout << " alpha1: " << _alpha1;
     cout << ", P($): " << _p_utt_boundary << endl;
   }
+  if (_sampler == BLOCK) {
+    cout << "Sampler: blocked";
+    if (_max_word_length)
+      cout << " (max word length " << _max_word_length << ")";
+    cout << endl;
+  }
+  if (_sampler == TYPE)
+    cout << "Sampler: type-based" << endl;
+  if (_nshards > 1) {
+    cout << "Parallel sampling: " << _nshards << " shards on "
+	 << _nthreads << " threads, merging ";
+    if (_sync_interval)
+      cout << "every " << _sync_interval << " utterances per shard" << endl;
+    else
+      cout << "once per iteration" << endl;
+  }
   cout << "Sampling of hyperparameters: ";
   if (SAMPLE_HYPERPARAMETERS)
     cout << "ON" << endl;
   else
     cout << "OFF" << endl;
-  unordered_map<char,Count> alphabet;
-  string s;
-  s = data->next_reference();
-  while (!s.empty()) {
-    Utterance u(s,b); //generates utterance w/ random segm.
-     _utterances.push_back(u);
-    _nutterances++;
-    string unsegmented = u.get_unsegmented();
-    for (Count i=0; i<unsegmented.length(); i++) {
-      alphabet[unsegmented[i]] = 1;
-    }
-    s = data->next_reference();
+  using namespace std::chrono;
+  steady_clock::time_point start = steady_clock::now();
+  size_t bytes = data->load(_corpus, _nthreads);
+  Float seconds = duration<Float>(steady_clock::now() - start).count();
+  _corpus.add_types();
+  _corpus.utterances(_utterances);
+  Float total = duration<Float>(steady_clock::now() - start).count();
+  if (bytes)
+    cerr << "Read " << _corpus.size() << " utterances ("
+	 << bytes/1e6 << " MB) in " << seconds << " s ("
+	 << bytes/1e6/max(seconds, 1e-9) << " MB/s)" << endl;
+  else  //a compiled corpus
+    cerr << "Opened " << _corpus.size() << " utterances in "
+	 << total << " s" << endl;
+  _nutterances = _utterances.size();
+  foreach (Utterances, u, _utterances) {
+    //random (or other) initial segmentation
+    u->init_boundaries(b);
   }
-  _alphabet_size = alphabet.size();
-  init_probs(); //need to do this before adding counts
+  _alphabet_size = _corpus.alphabet_size();
+  _p_word_cache.resize(SymbolTable::WORDS.size());
+  _log_length_ps.resize(_corpus.max_length()+1);
+  reset_p_word();
+  init_phoneme_probs(); //need to do this before adding counts
   // because it initializes phoneme probabilities, which
   // are needed for backoff probs when choosing tables.
+  foreach (Utterances, u, _utterances) {
+    u->init_log_phones(_log_phoneme_ps);
+  }
   foreach (Utterances, u, _utterances) {
     u->add_counts_to_lex(_word_counts, _bg_counts, _ngram);
   }
   //  cout << _smooth << endl;
 }
 
-void
-State::init_probs() {
-  cforeach(Utterances, u, _utterances) {
-    //add true words to lex
-    Utterance::Words wds = u->get_reference_words();
-    string prev = U_EDGE;
-    cforeach(Utterance::Words, w, wds) {
-      _true_word_ps.inc(*w);
-      bool inserted =_true_bg_ps.inc(Bigram(prev,*w));
-      if (inserted) _true_nfollow.inc(prev);
-      prev = *w;
-    }
-    bool inserted =_true_bg_ps.inc(Bigram(prev,U_EDGE));
-    if (inserted) _true_nfollow.inc(prev);
-  }
-  //normalize - give empirical prob over unigrams
-  foreach(WordProbs, w, _true_word_ps) {
-    Float ntokens = _true_word_ps.ntokens();
-    if (_bigram_model == U_TYPES)
-      w->second = 1.0/_true_word_ps.ntypes();
-    else 
-      w->second /= ntokens;
-  }
-  //normalize - give uniform prob over bigram types
-  foreach(BigramProbs, b, _true_bg_ps) {
-    b->second = 1.0/_true_nfollow(b->first.first);
-  }
-  //   cout << _bg_counts << endl;
-  //   cout << _true_word_ps << endl;
-  //  cout << _true_bg_ps << endl;
-  //  cout << _true_nfollow << endl;
-  init_phoneme_probs();
-}
-
 // prior prob of word w with length n =
 // alpha * p(n) * \prod_1^n p(w_i)
 // In bigram model, may need to compute p_word for utt boundaries,
 // and we also need to discount reg. words by the mass of utt b's.
+// The phonemes are read off the symbol table, last to first;
+// everything but the phonemes is in _log_length_ps.
 Float 
-State::p_word(const string& s) {
-  Float p=1;
-  if (s == U_EDGE) {
+State::compute_p_word(WordId w) {
+  Float p;
+  if (w == U_EDGE) {
     p = _alpha*prior_utt_boundary();
   }
   else {
-    PhoneProbs::const_iterator i;
-    cforeach (string, c, s) {
-      i = _phoneme_ps.find(*c);
+    const SymbolTable& words = SymbolTable::WORDS;
+    Float log_p = _log_length_ps[words.length(w)];
+    for (WordId c = w; c != SymbolTable::EDGE; c = words.parent(c)) {
       // make sure we have init'd all phoneme probs in this word.
       // (watch out for words not in the training data file)
-      my_assert(i != _phoneme_ps.end(), s);
-      p *= i->second;
+      my_assert(_phoneme_ps.count(words.last(c)), words.str(w));
+      log_p += _log_phoneme_ps[(unsigned char)words.last(c)];
     }
-    p *= _alpha* pow(1 - _p_boundary, (int)s.size()-1) * _p_boundary;
-    if (_ngram == 2)
-      p *= 1-prior_utt_boundary();
+    p = exp(log_p);
   }
-  debug_output(1000, "uni p_word(): (w, p(w)) = ", SF(s,p));
+  debug_output(1000, "uni p_word(): (w, p(w)) = ", SF(SymbolTable::WORDS.str(w),p));
   return p;
 }
 
-//generator prob of word w_j given prev word w_i
-//If table == - 1, we compute the probability for
-//adding a new bg.
-//If table != -1, bg is already assigned to table,
-//so we subtract that table when computing.
 Float
-State::p_word(const Bigram& bg, const BiLexicon& bg_lexicon, int table) {
-  my_assert(!(bg.first == U_EDGE && bg.second == U_EDGE), bg);
-  my_assert(_bigram_model == U_TABLES, "update p_word() or use -ut!\n");
-  Count ntables = bg_lexicon.ntables();
-  Count ntables_word = bg_lexicon.ntables(bg.second);
-  if (table >= 0 && 
-      bg_lexicon.ntokens(bg, (Count)table) == 1) {
-    ntables -= 1;
-    ntables_word -= 1;
-  }
-  debug_output(1000, "bi p_word(): (t(all), t(w2)) = ", 
-	       CC(ntables, ntables_word));
-  Float p = alpha1()* (ntables_word + p_word(bg.second)) /
-    (ntables + _alpha);
-  debug_output(800, "bi p_word() ((w1, w2), p1(w1,w2)) = : ", BiF(bg, p));
+State::cache_p_word(WordId w) {
+  _p_word_misses++;
+  return fill_p_word(w, compute_p_word(w));
+}
+
+Float
+State::fill_p_word(WordId w, Float p) {
+  if (w >= _p_word_cache.size()) {
+    if (w >= SymbolTable::WORDS.size())
+      return p;
+    _p_word_cache.resize(SymbolTable::WORDS.size());
+  }
+  CachedProb& c = _p_word_cache[w];
+  c.p = p;
+  c.epoch = _p_word_epoch;
   return p;
 }
 
+// drops all cached values of p_word(WordId) and
+// recomputes the length term for the current hyperparameters.
+void
+State::reset_p_word() {
+  _p_word_epoch++;
+  Float log_p = log(_alpha) + log(_p_boundary);
+  if (_ngram == 2)
+    log_p += log(1-prior_utt_boundary());
+  for (Count n = 1; n < _log_length_ps.size(); n++) {
+    _log_length_ps[n] = log_p;
+    log_p += log(1 - _p_boundary);
+  }
+}
+
 // use annealing temperature
 void
 State::sample(Float temp) {
+  Profile::Timer timer(Profile::SAMPLING);
   _word_counts.check_invariant();
-  foreach(Utterances, u, _utterances) {
-    u->sample(*this, temp, _ngram);
-  }
+  if (_ngram == 2)
+    _bg_counts.check_invariant();
+  (this->*_sweep)(temp);
   if (SAMPLE_HYPERPARAMETERS)
     hypersample(temp);
 }
 
+State::Sweep
+State::choose_sweep() {
+  if (_sampler == TYPE)
+    return &State::sample_types;
+  if (_sampler == BLOCK)
+    return &State::sample_block;
+  if (_nshards > 1)
+    return &State::sample_parallel;
+  if (_ngram == 2)
+    return &State::sample_single<2>;
+  return &State::sample_single<1>;
+}
+
+//the temperature changes between sweeps, so it is tested here,
+//once a sweep.
+template <int NGRAM>
+void
+State::sample_single(Float temp) {
+  if (temp == 1) {
+    foreach(Utterances, u, _utterances)
+      u->sample<NGRAM, false>(*this, temp);
+  }
+  else {
+    foreach(Utterances, u, _utterances)
+      u->sample<NGRAM, true>(*this, temp);
+  }
+}
+
+void
+State::sample_block(Float temp) {
+  foreach(Utterances, u, _utterances)
+    u->sample_block(*this, temp, _max_word_length);
+}
+
+void
+State::sample_types(Float temp) {
+  _type_sampler.sample(*this, _utterances, temp);
+}
+
+//what one shard samples in a round of sample_parallel().
+struct ShardJob {
+  Utterance** begin;
+  Utterance** end;
+  LocalLexicon* lexicon;
+  Rng rng;
+};
+
+//a round of sample_parallel(), shared out among the workers.
+struct ShardRound {
+  vector<ShardJob> jobs;
+  Count nthreads;
+  const State* state;
+  Float temp;
+  Count* tokens; //of each thread
+  Float* seconds;
+  Profile::Counts* profiles;
+  //what thread t does: samples the shards t, t+nthreads, ..., each
+  //with its own stream.  a thread other than the main one leaves
+  //its Profile counts in profiles[t], and starts them over.
+  void operator()(Count t) {
+    using namespace std::chrono;
+    steady_clock::time_point start = steady_clock::now();
+    for (Count s = t; s < jobs.size(); s += nthreads) {
+      ShardJob& job = jobs[s];
+      thread_rng_state() = &job.rng;
+      for (Utterance** u = job.begin; u != job.end; u++) {
+	(*u)->sample(*job.lexicon, *state, temp);
+	tokens[t] += (*u)->nwords();
+      }
+    }
+    seconds[t] += duration<Float>(steady_clock::now() - start).count();
+    thread_rng_state() = 0;
+    if (t) {
+      profiles[t] = Profile::counts();
+      Profile::counts() = Profile::Counts();
+    }
+  }
+};
+
+//approximate parallel sweep: the utterances are split into
+//_nshards contiguous shards, and each shard is sampled against
+//the lexicon as of the last merge plus its own changes.  every
+//_sync_interval utterances per shard the threads meet and the
+//shards' changes are merged, in shard order.  the threads wait in
+//_workers from one round, and sweep, to the next.  each shard
+//draws from its own stream, keyed by a number taken from the main
+//stream each round, so the result depends on the number of
+//shards and the interval but not on the number of threads or on
+//scheduling.
+void
+State::sample_parallel(Float temp) {
+  vector<Utterance*> utts;
+  foreach(Utterances, u, _utterances)
+    utts.push_back(&(*u));
+  Count nshards = min(_nshards, (Count)utts.size());
+  Count nthreads = min(_nthreads, nshards);
+  if (_local_lexicons.size() != nshards) {
+    _local_lexicons.clear();
+    for (Count s = 0; s < nshards; s++)
+      _local_lexicons.push_back(LocalLexicon(_word_counts));
+  }
+  if (_thread_tokens.size() != nthreads) {
+    _thread_tokens.assign(nthreads, 0);
+    _thread_seconds.assign(nthreads, 0);
+  }
+  //shard s is utts[first[s]] .. utts[first[s+1]-1]
+  Cs first(nshards+1);
+  for (Count s = 0; s <= nshards; s++)
+    first[s] = utts.size()*s/nshards;
+  Count share = 0; //the largest share
+  for (Count s = 0; s < nshards; s++)
+    share = max(share, first[s+1] - first[s]);
+  Count step = _sync_interval ? _sync_interval : share;
+  vector<Profile::Counts> profiles(nthreads);
+  ShardRound round;
+  round.jobs.resize(nshards);
+  round.nthreads = nthreads;
+  round.state = this;
+  round.temp = temp;
+  round.tokens = &_thread_tokens[0];
+  round.seconds = &_thread_seconds[0];
+  round.profiles = &profiles[0];
+  WorkerPool::Job job = std::ref(round);
+  Count nvisited = 0; //every utterance is sampled once a sweep
+  for (Count offset = 0; offset < share; offset += step) {
+    uint64_t key = main_rng().next();
+    for (Count s = 0; s < nshards; s++) {
+      Count begin = min(first[s] + offset, first[s+1]);
+      Count end = min(begin + step, first[s+1]);
+      nvisited += end - begin;
+      round.jobs[s].begin = &utts[0] + begin;
+      round.jobs[s].end = &utts[0] + end;
+      round.jobs[s].lexicon = &_local_lexicons[s];
+      round.jobs[s].rng.seed(key, s);
+    }
+    _workers.run(nthreads, job);
+    for (Count t = 1; t < nthreads; t++)
+      Profile::add(profiles[t]);
+    for (Count s = 0; s < nshards; s++) {
+      LocalLexicon& lexicon = _local_lexicons[s];
+      lexicon.merge(_word_counts);
+      cforeach(LocalLexicon::Probs, p, lexicon.new_p_words())
+	fill_p_word(p->first, p->second);
+      lexicon.clear_new_p_words();
+    }
+  }
+  my_assert(nvisited == utts.size(), nvisited);
+}
+
+void
+State::print_thread_stats(ostream& os) const {
+  for (Count t = 0; t < _thread_tokens.size(); t++) {
+    os << "thread " << t << ": " << _thread_tokens[t] << " tokens in "
+       << _thread_seconds[t] << " sec";
+    if (_thread_seconds[t] > 0)
+      os << " (" << _thread_tokens[t]/_thread_seconds[t] << " tokens/sec)";
+    os << endl;
+  }
+}
+
+//the p_word cache is saved too: a word's cached prob depends on
+//which of the two ways of computing it filled the entry, and so
+//may differ in the last bit from a recomputed one.
+void
+State::save(Checkpoint& c) const {
+  SymbolTable::WORDS.save(c);
+  _corpus.save_boundaries(c);
+  c.put(_alpha);
+  c.put(_alpha1);
+  c.put(_p_boundary);
+  c.put(_p_utt_boundary);
+  vector<WordId> ids;
+  Fs ps;
+  for (WordId w = 0; w < _p_word_cache.size(); w++) {
+    if (_p_word_cache[w].epoch == _p_word_epoch) {
+      ids.push_back(w);
+      ps.push_back(_p_word_cache[w].p);
+    }
+  }
+  c.put(ids);
+  c.put(ps);
+  _word_counts.save(c);
+  _bg_counts.save(c);
+  _type_sampler.save(c);
+  c.put(main_rng());
+}
+
+void
+State::restore(Checkpoint& c) {
+  SymbolTable::WORDS.restore(c);
+  _corpus.restore_boundaries(c);
+  c.get(_alpha);
+  c.get(_alpha1);
+  c.get(_p_boundary);
+  c.get(_p_utt_boundary);
+  reset_p_word();
+  vector<WordId> ids;
+  Fs ps;
+  c.get(ids);
+  c.get(ps);
+  my_assert(ids.size() == ps.size(), CC(ids.size(), ps.size()));
+  for (Count k = 0; k < ids.size(); k++)
+    fill_p_word(ids[k], ps[k]);
+  _word_counts.restore(c);
+  _bg_counts.restore(c);
+  _type_sampler.restore(c, _utterances);
+  c.get(main_rng());
+  _local_lexicons.clear();
+}
+
 //sample hyperparameters: 
 //alpha,  alpha1, p_boundary, p_utt_boundary
 void 
 State::hypersample(Float temp){
+  Profile::Timer timer(Profile::HYPERPARAMETERS);
   bool changed = sample_hyperparm(_alpha, false, temp);
   //  changed ? cout << "new alpha0: " << _alpha << endl : cout << "old alpha0: " << _alpha << endl;
   if (_ngram == 2) {
-    changed = sample_hyperparm(_alpha1, false, temp);
+    changed = sample_hyperparm(_alpha1, false, temp, false);
     //    changed ? cout << "new alpha1: " << _alpha1 << endl : cout << "old alpha1: " << _alpha1 << endl;
   }
   changed = sample_hyperparm(_p_boundary, true, temp);
@@ -247,11 +498,20 @@ State::hypersample(Float temp){
   //  changed ? cout << "new p_utt_boundary: " << _p_utt_boundary << endl : cout << "old p_utt_boundary: " << _p_utt_boundary << endl;
 }
 
+//recomputes what depends on the hyperparameters: p_word() (if
+//in_base) and the BiLexicon's running sum over words' tables.
+void
+State::hyperparm_changed(bool in_base) {
+  if (in_base) reset_p_word();
+  if (_ngram == 2)
+    _bg_counts.reset_log_labels();
+}
+
 //beta is the hyperparameter to be sampled.
 //assume beta must be > 0.  If beta must be < 1, set flag.
 // returns true if value of beta changed.
 bool
-State::sample_hyperparm(Float& beta, bool is_prob, Float temp) {
+State::sample_hyperparm(Float& beta, bool is_prob, Float temp, bool in_base) {
   Float std_ratio = HYPERSAMPLING_RATIO;
   Float old_beta = beta;
   Float new_beta;
@@ -267,6 +527,7 @@ State::sample_hyperparm(Float& beta, bool is_prob, Float temp) {
   }
   Float old_p = log_posterior();
   beta = new_beta;
+  hyperparm_changed(in_base);
   Float new_p = log_posterior();
   Float r = exp(new_p-old_p)*
     normal_density(old_beta, new_beta, std_ratio*new_beta)/
@@ -282,86 +543,120 @@ State::sample_hyperparm(Float& beta, bool is_prob, Float temp) {
   else {
     //cout << "-";
     beta = old_beta;
+    hyperparm_changed(in_base);
   }
   //cout << ";  %beta(o/n), P(o/n), diff, r, up/do, ac/re" << endl;
   return changed;
 }
 
 
-// generates (prints) a single random utterance
+// generates n random utterances.  the distributions that do not
+// depend on the previous word are put in alias tables once, so
+// each draw from them is O(1).  NONE stands for a novel word in
+// the urns.
 void
-State::generate() const {
+State::generate(Count n, ostream& os) const {
+  const SymbolTable& words = SymbolTable::WORDS;
+  PhonemeUrn phonemes;
+  cforeach(PhoneProbs, p, _phoneme_ps)
+    phonemes.push(p->first, p->second);
+  phonemes.build_alias();
+  Urn<WordId, Float> urn;
+  string line;
   if (_ngram == 1) {
-    cout << generate_word();
+    urn.reserve(_word_counts.ntypes()+1);
+    for (WordId j = 1; j < _word_counts.nids(); j++) {
+      if (_word_counts(j))
+	urn.push(j, _word_counts(j));
+    }
+    urn.push(SymbolTable::NONE, alpha());
+    urn.build_alias();
     Float p_stop = 1.0 - 
       p_cont2(_word_counts.ntokens(), _nutterances);
-    while (randd() >= p_stop) {
-      cout << " " << generate_word();
+    for (Count k = 0; k < n; k++) {
+      line.clear();
+      do {
+	WordId w = urn.draw();
+	if (w == SymbolTable::NONE)
+	  w = generate_novel_word(phonemes);
+	if (!line.empty()) line += ' ';
+	line += words.str(w);
+      } while (randd() >= p_stop);
+      line += '\n';
+      os << line;
     }
-    cout << endl;
   }
   else if (_ngram == 2) {
-    string previous = generate_word(U_EDGE);
-    cout << previous;
-    while (previous != U_EDGE) {
-      string current = generate_word(previous);
-      if (current != U_EDGE) {
-	cout << " " << current;
-      }
-      previous = current;
+    novel_second_urn(urn);
+    Contexts contexts;
+    for (Count k = 0; k < n; k++) {
+      line.clear();
+      WordId previous = U_EDGE;
+      do {
+	WordId current = generate_word(previous, urn, contexts);
+	if (current == SymbolTable::NONE)
+	  current = generate_novel_word(phonemes);
+	if (current != U_EDGE) {
+	  if (!line.empty()) line += ' ';
+	  line += words.str(current);
+	}
+	previous = current;
+      } while (previous != U_EDGE);
+      line += '\n';
+      os << line;
     }
-    cout << endl;
   }
 }
 
-//unigram
-string
-State::generate_word() const {
-    Urn<string, Float> words;
-    words.reserve(_word_counts.ntypes()+1);
-    cforeach(Lexicon, j, _word_counts) {
-      words.push(j->first, j->second);
-    }
-    words.push(generate_novel_word(), alpha());
-    return words.draw();
+// the monkey model: phonemes drawn independently, with a
+// boundary after each with prob p_boundary.
+WordId
+State::generate_novel_word(const PhonemeUrn& phonemes) const {
+  WordId w = SymbolTable::EDGE;
+  do {
+    w = SymbolTable::WORDS.extend(w, phonemes.draw());
+  } while (randd() >= _p_boundary);
+  return w;
 }
 
-//bigram
-string
-State::generate_word(const string& previous) const {
+//bigram.  novel is the alias urn from novel_second_urn(), and
+//contexts holds the alias urns of the successors of the previous
+//words seen so far, which are built on first use.
+WordId
+State::generate_word(WordId previous, const Urn<WordId, Float>& novel,
+		     Contexts& contexts) const {
   // previous word was novel
-  if (_word_counts(previous) == 0 && previous != U_EDGE) {
-    return generate_novel_second(previous);
+  if (previous != U_EDGE && _word_counts(previous) == 0) {
+    return generate_novel_second(previous, novel);
   }
-  else {
-    Urn<string, Float> words;
-    words.reserve(_bg_counts.ntypes()+ 1);
-    cforeach(BiLexicon, j, _bg_counts) {
-      if (j->first.first == previous) {
-	words.push(j->first.second, j->second);
-      }
-    }
-    words.push(generate_novel_second(previous), alpha1());
-    return words.draw();
+  Urn<WordId, Float>& words = contexts[previous];
+  if (words.empty()) {
+    const vector<WordId>& next = _bg_counts.successors(previous);
+    words.reserve(next.size());
+    cforeach(vector<WordId>, w, next)
+      words.push(*w, _bg_counts(Bigram(previous, *w)));
+    if (words.empty())
+      return generate_novel_second(previous, novel);
+    words.build_alias();
   }
+  if (randd() * (words.sum_weights() + alpha1()) < alpha1())
+    return generate_novel_second(previous, novel);
+  return words.draw();
 }
 
-// generates the second word of a novel bigram
-string
-State::generate_novel_second(const string& previous) const {
+// the distribution of the second word of a novel bigram, except
+// for U_EDGE, which generate_novel_second() adds.
+void
+State::novel_second_urn(Urn<WordId, Float>& words) const {
   if (_bigram_model == U_TABLES) {
-    Urn<string, Float> words;
-    words.reserve(_word_counts.ntypes());
-    cforeach(Lexicon, j, _word_counts) {
-      words.push(j->first,
-		 _bg_counts.ntables(j->first));
+    words.clear();
+    words.reserve(_bg_counts.tables().ntypes()+1);
+    cforeach(BiLexicon::Tables, t, _bg_counts.tables()) {
+      if (t->first != U_EDGE)
+	words.push(t->first, t->second);
     }
-    words.push(generate_novel_word(), alpha());
-    if (previous != U_EDGE) {
-      words.push(U_EDGE,
-		 _bg_counts.ntables(U_EDGE));
-    }
-    return words.draw();
+    words.push(SymbolTable::NONE, alpha());
+    words.build_alias();
   }
   else {
     cerr << "generate_word is only implemented for -u" << endl;
@@ -369,8 +664,100 @@ State::generate_novel_second(const string& previous) const {
   }
 }
 
+// generates the second word of a novel bigram
+WordId
+State::generate_novel_second(WordId previous,
+			     const Urn<WordId, Float>& novel) const {
+  if (previous != U_EDGE) {
+    Float edge = _bg_counts.ntables(U_EDGE);
+    if (randd() * (novel.sum_weights() + edge) < edge)
+      return U_EDGE;
+  }
+  return novel.draw();
+}
+
+void
+State::get_posterior(Posterior& posterior) const {
+  const Lexicon& lexicon = _word_counts;
+  posterior.ngram = _ngram;
+  posterior.nutterances = _nutterances;
+  posterior.ntokens = lexicon.ntokens();
+  posterior.ntypes = lexicon.ntypes();
+  posterior.ntables = _bg_counts.ntables();
+  posterior.alpha = _alpha;
+  posterior.alpha1 = _alpha1;
+  posterior.log_seating = _bg_counts.log_seating();
+  posterior.log_labels = _bg_counts.log_labels();
+  posterior.words.clear();
+  posterior.words.reserve(lexicon.ntypes());
+  //the model is tested once, not per word.
+  if (_ngram == 1) {
+    cforeach(vector<WordId>, w, lexicon.types())
+      posterior.words.push_back(CF(lexicon(*w), p_word(*w)));
+  }
+  else {
+    cforeach(vector<WordId>, w, lexicon.types())
+      posterior.words.push_back(CF(lexicon(*w), 0));
+  }
+}
+
 Float
 State::log_posterior() const {
+  Profile::Timer timer(Profile::POSTERIOR);
+  Posterior posterior;
+  get_posterior(posterior);
+  Float prob = posterior.log_prob();
+#ifndef NDEBUG
+  if (debug_level >= 100) {
+    Float replayed = log_posterior_replay();
+    my_assert(fabs(prob - replayed) <= 1e-6*fabs(replayed), FF(prob, replayed));
+  }
+#endif
+  return prob;
+}
+
+Float
+State::Posterior::log_prob() const {
+  //the joint is exchangeable, so it depends only on the counts:
+  //each Chinese restaurant contributes a ratio of gamma functions.
+  Count n = ntokens;
+  Float prob = 0;
+  if (ngram == 1) {
+    //words: prod_w Gamma(n_w + alpha*P0(w))/Gamma(alpha*P0(w)),
+    //over Gamma(n + alpha)/Gamma(alpha)
+    cforeach(CFs, w, words) {
+      Float a = w->second;
+      prob += lgamma(w->first + a) - lgamma(a);
+    }
+    prob += lgamma(alpha) - lgamma(n + alpha);
+    //S -> W S (n - nutts times) vs. S -> W (nutts times)
+    Float b = beta()/2;
+    prob += lgamma(n - nutterances + b) + lgamma(nutterances + b) -
+      2*lgamma(b) + lgamma(beta()) - lgamma(n + beta());
+  }
+  else if (ngram == 2) {
+    //every token of a word (and every $$) is the context of one
+    //bigram, so each context c pays Gamma(n_c + alpha1)/Gamma(alpha1)
+    cforeach(CFs, w, words)
+      prob -= lgamma(w->first + alpha1);
+    prob -= lgamma(nutterances + alpha1);
+    prob += (ntypes + 1) * lgamma(alpha1);
+    //each table with k tokens: alpha1 * (k-1)!  (the two sums over
+    //tables are kept by the BiLexicon as tables fill and empty.)
+    prob += ntables * log(alpha1) + log_seating;
+    //tables are drawn from the unigram CRP over words
+    prob += log_labels;
+    prob += lgamma(alpha) - lgamma(ntables + alpha);
+  }
+  else
+    my_assert(0,"unknown model in State::log_posterior");
+  return prob;
+}
+
+//the same, by adding the words of each utterance in turn
+//to an empty lexicon.  slow; used to check log_posterior().
+Float
+State::log_posterior_replay() const {
   Float prob = 0;
   Count nutts = 0;
   //start w/ empty lexicon
@@ -391,44 +778,66 @@ State::log_posterior() const {
 
 void
 State::init_phoneme_probs() {
-    //determine phoneme counts in true word types
-  StringLexicon alphabet;
-    cforeach(WordProbs, w, _true_word_ps) {
-      for (Count i=0; i<w->first.length(); i++) {
-	alphabet.inc(w->first.substr(i,1));
-      }
-    }
+  //the phonemes are the characters of the true word types.
+  Count ntokens = 0;
+  for (Count c = 0; c < 256; c++)
+    ntokens += _corpus.type_chars(c);
   //init w/ true distr. -- doesn't make much diff.
   if ((_unigram_model == VARI_MONKEYS) ||
       (_bigram_model == VARI_MONKEYS)) {
     cout << "Phoneme distribution: true" << endl;
-    cforeach(StringLexicon, c, alphabet) {
-      _phoneme_ps[c->first[0]] = (double)alphabet(c->first)/alphabet.ntokens();
+    for (Count c = 0; c < 256; c++) {
+      if (_corpus.type_chars(c))
+	_phoneme_ps[(char)c] = (double)_corpus.type_chars(c)/ntokens;
     }
   }
   else {  //init w/ uniform distr.
     cout << "Phoneme distribution: uniform" << endl;
-    cforeach(StringLexicon, c, alphabet) {
-      _phoneme_ps[c->first[0]] = 1.0/_alphabet_size;
+    for (Count c = 0; c < 256; c++) {
+      if (_corpus.type_chars(c))
+	_phoneme_ps[(char)c] = 1.0/_alphabet_size;
     }
   }
   assert(_phoneme_ps.size() == _alphabet_size);
+  cforeach(PhoneProbs, c, _phoneme_ps) {
+    _log_phoneme_ps[(unsigned char)c->first] = log(c->second);
+  }
+}
+
+void
+State::get_stats(Stats& stats) const {
+  stats.p_cont = p_cont();
+  stats.ntypes = _word_counts.ntypes();
+  stats.ntokens = _word_counts.ntokens();
+  stats.bg_ntypes = _bg_counts.ntypes();
+  stats.bg_ntokens = _bg_counts.ntokens();
+  stats.bg_ntables = _bg_counts.ntables();
+  stats.p_boundary = _p_boundary;
+  stats.p_utt_boundary = _p_utt_boundary;
+  get_posterior(stats.posterior);
 }
 
 void
 State::print_stats (ostream& os) const {
+  Stats stats;
+  get_stats(stats);
+  stats.print(os);
+}
+
+void
+State::Stats::print(ostream& os) const {
   Count op = os.precision();
   os.precision(6);
   os.width(os.precision());
-  os << left << p_cont() << ", ";
+  os << left << p_cont << ", ";
   os.width(1);
-  os << _word_counts.ntypes() << ", " << _word_counts.ntokens() << ", "
-     << _bg_counts.ntypes() << ", " << _bg_counts.ntokens() << ", "
-     << _bg_counts.ntables() << ", ";
+  os << ntypes << ", " << ntokens << ", "
+     << bg_ntypes << ", " << bg_ntokens << ", "
+     << bg_ntables << ", ";
   os.width(os.precision());
-  os << left << -1*log_posterior() << ", "
-     << _alpha << ", " << _alpha1 << ", " 
-     << _p_boundary << ", " << _p_utt_boundary << ";" << endl;
+  os << left << -1*posterior.log_prob() << ", "
+     << posterior.alpha << ", " << posterior.alpha1 << ", " 
+     << p_boundary << ", " << p_utt_boundary << ";" << endl;
   os.width(1);
   os.precision(op);
 }
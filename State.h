@@ -4,8 +4,14 @@
 #include <iostream>
 #include "typedefs.h"
 #include "Datafile.h"
+#include "Corpus.h"
 #include "Scoring.h"
 #include "BiLexicon.h"
+#include "TypeSampler.h"
+#include "Urn.h"
+#include "Checkpoint.h"
+#include "Profile.h"
+#include "WorkerPool.h"
 
 /* State keeps track of global state of the current hypothesis
 for Gibbs sampler, as well as values of hyperparameters.
@@ -18,17 +24,221 @@ extern Float HYPERSAMPLING_RATIO; // the standard deviation for new hyperparm pr
 extern bool SAMPLE_HYPERPARAMETERS;
 
 typedef unordered_map<char,Float> PhoneProbs;
-typedef SGLexicon<string,Float> WordProbs;
-typedef SGLexicon<Bigram,Float> BigramProbs;
 
-class Lexicon: public SGLexicon<string,Count> {
+/*
+Lexicon counts word tokens by WordId.  Ids are dense, so the
+counts live in a flat array indexed by id, and once the array
+covers the symbol table inc() and dec() never allocate.  The ids
+with nonzero counts are also kept in a list (each id knowing its
+place in it), so the types can be visited without scanning ids.
+*/
+class Lexicon {
+public:
+  Lexicon(): _ntokens(0) {}
+  Count operator()(WordId w) const {
+    my_assert(w != U_EDGE, "Do not search for $$ in Lexicon!\n");
+    Profile::count(Profile::LOOKUPS);
+    if (w >= _counts.size()) return 0;
+    return _counts[w];
+  }
+  //return 1 if a new type was added, else 0.
+  size_t inc(WordId w) {
+    my_assert(w != U_EDGE && w < SymbolTable::WORDS.size(), w);
+    if (w >= _counts.size())
+      grow();
+    _ntokens++;
+    if (_counts[w]++ == 0) {
+      add_type(w);
+      return 1;
+    }
+    return 0;
+  }
+  //return 1 if a type was deleted, else 0.
+  size_t dec(WordId w) {
+    my_assert(w < _counts.size() && _counts[w] > 0, w);
+    _ntokens--;
+    if (--_counts[w] == 0) {
+      remove_type(w);
+      return 1;
+    }
+    return 0;
+  }
+  //add n (possibly negative) tokens of w at once.
+  void add(WordId w, long n) {
+    my_assert(w != U_EDGE && w < SymbolTable::WORDS.size(), w);
+    if (w >= _counts.size())
+      grow();
+    my_assert((long)_counts[w] + n >= 0, CC(w, _counts[w]));
+    if (_counts[w] == 0 && n > 0) add_type(w);
+    _counts[w] += n;
+    _ntokens += n;
+    if (_counts[w] == 0 && n < 0) remove_type(w);
+  }
+  Count ntokens() const {return _ntokens;}
+  size_t ntypes() const {return _types.size();}
+  //the ids with nonzero counts, in no particular order.
+  const vector<WordId>& types() const {return _types;}
+  // ids at or beyond this bound have count 0.
+  WordId nids() const {return _counts.size();}
+  void clear() {
+    _counts.clear();
+    _type_index.clear();
+    _types.clear();
+    _ntokens = 0;
+  }
+  void save(Checkpoint& c) const {
+    c.put(_counts);
+    c.put(_type_index);
+    c.put(_types);
+    c.put(_ntokens);
+  }
+  void restore(Checkpoint& c) {
+    c.get(_counts);
+    c.get(_type_index);
+    c.get(_types);
+    c.get(_ntokens);
+  }
+  void check_invariant() const {
+#ifndef NDEBUG
+    Count total = 0;
+    size_t types = 0;
+    for (WordId w = 0; w < _counts.size(); w++) {
+      total += _counts[w];
+      if (_counts[w]) types++;
+    }
+    my_assert(total == _ntokens, CC(total, _ntokens));
+    my_assert(types == _types.size(), CC(types, _types.size()));
+    for (Count k = 0; k < _types.size(); k++)
+      my_assert(_counts[_types[k]] && _type_index[_types[k]] == k, k);
+#endif
+  }
+  friend ostream& operator<< (ostream& os, const Lexicon& lexicon) {
+    for (WordId w = 1; w < lexicon.nids(); w++) {
+      if (lexicon(w))
+        os << SymbolTable::WORDS.str(w) << " " << lexicon(w) << endl;
+    }
+    os << "Total lexicon tokens: " << lexicon.ntokens() << endl;
+    os << "Total lexicon types: " << lexicon.ntypes() << endl;
+    return os;
+  }
+private:
+  Cs _counts;
+  vector<uint32_t> _type_index; //place of each type in _types
+  vector<WordId> _types;
+  Count _ntokens;
+  void grow() {
+    _counts.resize(SymbolTable::WORDS.size(), 0);
+    _type_index.resize(SymbolTable::WORDS.size(), 0);
+  }
+  void add_type(WordId w) {
+    Profile::count(Profile::TYPES_CREATED);
+    _type_index[w] = _types.size();
+    _types.push_back(w);
+  }
+  //moves the last type into w's place.
+  void remove_type(WordId w) {
+    Profile::count(Profile::TYPES_DELETED);
+    WordId last = _types.back();
+    _types[_type_index[w]] = last;
+    _type_index[last] = _type_index[w];
+    _types.pop_back();
+  }
+};
+
+/*
+LocalLexicon is one worker's view of the Lexicon during a parallel
+sweep: the shared counts, which nobody changes until the workers
+are joined, plus a private delta for the changes this worker has
+made.  SymbolTable::WORDS can't change during the sweep either, so
+a word the worker adds that is not in it goes into a table of the
+worker's own, with an id from NOVEL up.  merge() folds the delta
+back into the shared Lexicon, adding those words to WORDS.
+*/
+class LocalLexicon {
 public:
-  Lexicon() {}
-  virtual ~Lexicon() {}
-  virtual Count operator()(const string& s) const {
-    my_assert(s != U_EDGE, "Do not search for $$ in Lexicon!\n");
-    return SGLexicon<string, Count>::operator() (s);
+  static const WordId NOVEL = 0x80000000;
+  LocalLexicon(const Lexicon& shared):
+    _shared(shared), _delta(SymbolTable::WORDS.size(), 0), _dtokens(0) {}
+  Count operator()(WordId w) const {
+    if (w >= NOVEL)
+      return w - NOVEL < _novel_counts.size() ? _novel_counts[w - NOVEL] : 0;
+    return _shared(w) + (w < _delta.size() ? _delta[w] : 0);
+  }
+  //the id of the n chars from s, or NONE (see SymbolTable).
+  WordId find(const char* s, size_t n) const {
+    WordId w = SymbolTable::WORDS.find(s, n);
+    if (w == SymbolTable::NONE && _novel.size() > 1) {
+      WordId v = _novel.find(s, n);
+      if (v != SymbolTable::NONE)
+	w = NOVEL + v;
+    }
+    return w;
+  }
+  WordId intern(const char* s, size_t n) {
+    WordId w = find(s, n);
+    if (w == SymbolTable::NONE)
+      w = NOVEL + _novel.intern(s, n);
+    return w;
   }
+  void inc(WordId w) {
+    my_assert(w != U_EDGE && w != SymbolTable::NONE, w);
+    _dtokens++;
+    if (w >= NOVEL) {
+      if (w - NOVEL >= _novel_counts.size())
+	_novel_counts.resize(_novel.size(), 0);
+      _novel_counts[w - NOVEL]++;
+      return;
+    }
+    if (w >= _delta.size())
+      _delta.resize(SymbolTable::WORDS.size(), 0);
+    if (_delta[w]++ == 0) _touched.push_back(w);
+  }
+  void dec(WordId w) {
+    my_assert((*this)(w) > 0, w);
+    _dtokens--;
+    if (w >= NOVEL) {
+      _novel_counts[w - NOVEL]--;
+      return;
+    }
+    if (w >= _delta.size())
+      _delta.resize(SymbolTable::WORDS.size(), 0);
+    if (_delta[w]-- == 0) _touched.push_back(w);
+  }
+  Count ntokens() const {return _shared.ntokens() + _dtokens;}
+  //add the delta to lexicon (which must be the shared one) and
+  //clear it.
+  void merge(Lexicon& lexicon) {
+    my_assert(&lexicon == &_shared, "merging into the wrong Lexicon");
+    foreach(vector<WordId>, w, _touched) {
+      if (_delta[*w]) {
+	lexicon.add(*w, _delta[*w]);
+	_delta[*w] = 0;
+      }
+    }
+    for (WordId v = 1; v < _novel_counts.size(); v++) {
+      if (_novel_counts[v])
+	lexicon.add(SymbolTable::WORDS.intern(_novel.str(v)),
+		    _novel_counts[v]);
+    }
+    _novel.clear();
+    _novel_counts.clear();
+    _touched.clear();
+    _dtokens = 0;
+  }
+  //workers may only read State's p_word cache, so the values they
+  //compute on a miss are kept here, to be cached after the join.
+  typedef vector<pair<WordId, Float> > Probs;
+  void note_p_word(WordId w, Float p) const {_new_p_words.push_back(make_pair(w, p));}
+  const Probs& new_p_words() const {return _new_p_words;}
+  void clear_new_p_words() {_new_p_words.clear();}
+private:
+  const Lexicon& _shared;
+  mutable Probs _new_p_words;
+  vector<int32_t> _delta;
+  vector<WordId> _touched; //ids whose delta may be nonzero
+  SymbolTable _novel; //words not in SymbolTable::WORDS
+  Cs _novel_counts;
+  long _dtokens;
 };
 
 class State {
@@ -37,6 +247,22 @@ public:
   // and whether to use unigram or bigram sampling.
   // Call this before calling constructor.
   static void set_models(string uni, string bi, int ngram, Float noise=.0001);
+  // sets the sampler: "single" (one boundary at a time),
+  // "block" (whole utterances, unigram only) or "type" (all
+  // boundaries of a type at once, unigram only), and the maximum
+  // word length considered by the blocked sampler (0 = no limit).
+  // Call this after set_models().
+  static void set_sampler(string sampler, Count max_length=0);
+  // sets the number of threads for the single-site unigram sampler.
+  // utterances are split into nshards shards (0 = one per thread),
+  // which sample against the lexicon as it was at the last sync
+  // plus their own changes; the changes are merged after every
+  // sync_interval utterances per shard (0 = once per sweep).  the
+  // shards are shared out among nthreads threads, which does not
+  // change the result.  with one shard (the default) sampling is
+  // exact.  Call this after set_sampler().
+  static void set_threads(Count nthreads, Count sync_interval=0,
+			  Count nshards=0);
   //data is to read utterances from,
   //alpha is the Dirichlet hyperparam,
   //b is the prior prob. of a boundary.
@@ -73,30 +299,134 @@ public:
     return (bg_lexicon.ntables(U_EDGE) + beta()/2) /
       (bg_lexicon.ntables() + beta());
   }
-  //prior prob of a word (alpha * generator prob)
-  static Float p_word(const string& s);
+  //prior prob of a word (alpha * generator prob).
+  //memoized per word type; the cache is dropped whenever
+  //alpha, p_boundary or p_utt_boundary changes.
+  static Float p_word(WordId w) {
+    if (w < _p_word_cache.size() && _p_word_cache[w].epoch == _p_word_epoch) {
+      _p_word_hits++;
+      return _p_word_cache[w].p;
+    }
+    return cache_p_word(w);
+  }
+  //as above, for a word whose phonemes have log probability
+  //log_phones and whose length is n (see Utterance::p_word()),
+  //so that a cache miss costs O(1) rather than O(n).  w may be
+  //NONE, for a word not in the table, which is not cached.
+  static Float p_word(WordId w, Float log_phones, Count n) {
+    if (w < _p_word_cache.size() && _p_word_cache[w].epoch == _p_word_epoch) {
+      _p_word_hits++;
+      return _p_word_cache[w].p;
+    }
+    _p_word_misses++;
+    return fill_p_word(w, exp(log_phones + _log_length_ps[n]));
+  }
+  //as above, but never writes the cache, so it is safe to call from
+  //worker threads while nobody else writes it either.  a miss is
+  //noted in lexicon, and cached after the sweep.
+  static Float p_word(WordId w, Float log_phones, Count n,
+		      const LocalLexicon& lexicon) {
+    if (w < _p_word_cache.size() && _p_word_cache[w].epoch == _p_word_epoch)
+      return _p_word_cache[w].p;
+    Float p = exp(log_phones + _log_length_ps[n]);
+    if (w < SymbolTable::WORDS.size())
+      lexicon.note_p_word(w, p);
+    return p;
+  }
+  //log prob of each phoneme, indexed by (unsigned char)
+  static const Fs& log_phoneme_ps() {return _log_phoneme_ps;}
+  static Count p_word_cache_hits() {return _p_word_hits;}
+  static Count p_word_cache_misses() {return _p_word_misses;}
   //prior prob of a word given previous word.
-  // table is current table of bg. (-1 if adding new bg)
+  // table is the number of tokens at bg's table. (-1 if adding new bg)
   Float p_word(const Bigram& bg, int table = -1) const {
     return p_word(bg, _bg_counts, table);
   }
+  //inline, as the bigram sweep calls it several times a boundary.
+  //only the unigram-tables generator (-ut) is implemented, which
+  //the constructor checks once.
   static Float p_word(const Bigram& bg, 
-		      const BiLexicon& bg_lexicon, int table = -1);
+		      const BiLexicon& bg_lexicon, int table = -1) {
+    my_assert(!(bg.first == U_EDGE && bg.second == U_EDGE), bg);
+    Count ntables = bg_lexicon.ntables();
+    Count ntables_word = bg_lexicon.ntables(bg.second);
+    if (table == 1) {
+      ntables -= 1;
+      ntables_word -= 1;
+    }
+    debug_output(1000, "bi p_word(): (t(all), t(w2)) = ", 
+		 CC(ntables, ntables_word));
+    Float p = alpha1()* (ntables_word + p_word(bg.second)) /
+      (ntables + _alpha);
+    debug_output(800, "bi p_word() ((w1, w2), p1(w1,w2)) = : ",
+		 make_pair(bg, p));
+    return p;
+  }
   Float alphabet_size() const {return _alphabet_size;}
   Lexicon& get_lexicon() {return _word_counts;}
   BiLexicon& get_bilexicon() {return _bg_counts;}
-  const Count nutterances() {return _nutterances;}
+  const BiLexicon& get_bilexicon() const {return _bg_counts;}
+  Count nutterances() const {return _nutterances;}
   //use annealing temperature temp
   void sample(Float temp=1);
   void hypersample(Float temp);
-  void generate() const;
+  //write n utterances generated from the current counts to os,
+  //one per line with a space between words.  novel words are
+  //drawn from the base distribution.
+  void generate(Count n=1, ostream& os=cout) const;
+  //log joint prob of the current segmentation (and tables),
+  //computed from the counts in time linear in the number of
+  //types (the terms for the bigram tables are kept up to date by
+  //BiLexicon as they change).
   Float log_posterior() const;
+  //the terms of log_posterior(), copied so that it can be
+  //computed later, or on another thread: each word type's count
+  //and (in the unigram model) its prior prob, plus the totals.
+  struct Posterior {
+    int ngram;
+    Count nutterances;
+    Count ntokens;
+    Count ntypes;
+    Count ntables;
+    Float alpha;
+    Float alpha1;
+    Float log_seating;
+    Float log_labels;
+    CFs words;
+    Float log_prob() const;
+  };
+  void get_posterior(Posterior& posterior) const;
+  //what print_stats() prints, copied in the same way.
+  struct Stats {
+    Float p_cont;
+    Count ntypes;
+    Count ntokens;
+    Count bg_ntypes;
+    Count bg_ntokens;
+    Count bg_ntables;
+    Float p_boundary;
+    Float p_utt_boundary;
+    Posterior posterior;
+    void print(ostream& os) const;
+  };
+  void get_stats(Stats& stats) const;
+  const Corpus& corpus() const {return _corpus;}
+  Utterances& utterances() {return _utterances;}
   void score_utterances(Scoring& scoring) {
     foreach(Utterances, u, _utterances) {
       scoring.score_utterance(&(*u));
     }
   }
+  //appends everything sampling depends on (the boundaries,
+  //lexicons, tables, hyperparameters, p_word cache and main_rng())
+  //to c, or replaces it with what restore() reads from c.  the
+  //state must have been made from the same corpus with the same
+  //settings.
+  void save(Checkpoint& c) const;
+  void restore(Checkpoint& c);
   void print_stats (ostream& os) const;
+  //tokens/sec of each worker thread over all parallel sweeps
+  void print_thread_stats (ostream& os) const;
   void print_stats_header (ostream& os) const;
   friend ostream& operator<< (ostream& os, const State& state) {
     cforeach(Utterances, i, state._utterances) {
@@ -105,33 +435,83 @@ public:
     return os;
   }
 private:
-  Utterances _utterances;
+  Corpus _corpus; //the text of the utterances
+  Utterances _utterances; //views of _corpus
   Count _nutterances;
   Count _alphabet_size;
   Lexicon _word_counts;
   BiLexicon _bg_counts;
+  TypeSampler _type_sampler;
+  vector<LocalLexicon> _local_lexicons; //one per shard
+  WorkerPool _workers; //the threads of parallel sweeps
+  Cs _thread_tokens; //word tokens sampled by each worker
+  Fs _thread_seconds; //time spent sampling by each worker
 
   enum {MONKEYS, VARI_MONKEYS,
 	U_SAMPLE, U_TABLES, U_TOKENS, U_TYPES, B_TYPES};
   static int _unigram_model;
   static int _bigram_model;
   static int _ngram; //which model to use (1 or 2)
+  enum {SINGLE, BLOCK, TYPE};
+  static int _sampler;
+  static Count _max_word_length; //for the blocked sampler
+  static Count _nthreads;
+  static Count _sync_interval; //utts per shard between merges (0 = sweep)
+  static Count _nshards;
   static Float _noise; //how much noise to use when generators use true forms.
   static Float _alpha; //total weight of unigram generator
   static Float _alpha1; //total weight of bigram generator
   static Float _p_boundary;
   static Float _p_utt_boundary;
   static PhoneProbs _phoneme_ps;
-  static WordProbs _true_word_ps; //true words in data
-  static BigramProbs _true_bg_ps; //true bigrams in the data
-  static StringLexicon _true_nfollow; //number of types following each type in true data.
-  void init_probs();
+  //one sweep, of whichever kind set_models(), set_sampler() and
+  //set_threads() asked for.  the constructor picks it, so the
+  //model and sampler are decided once per run rather than inside
+  //the sweep.
+  typedef void (State::*Sweep)(Float temp);
+  static Sweep _sweep;
+  static Sweep choose_sweep();
+  template <int NGRAM> void sample_single(Float temp);
+  void sample_block(Float temp);
+  void sample_types(Float temp);
+  void sample_parallel(Float temp);
+  Float log_posterior_replay() const;
   void init_phoneme_probs();
-  bool sample_hyperparm(Float& beta, bool is_prob, Float temp=1);
-  string generate_word() const;
-  string generate_word(const string& previous) const;
-  string generate_novel_word() const {return "NOVEL";};
-  string generate_novel_second(const string& previous) const;
+  //in_base is true if beta is a parameter of p_word(WordId).
+  bool sample_hyperparm(Float& beta, bool is_prob, Float temp=1,
+			bool in_base=true);
+  // cache entries are valid only if their epoch is current,
+  // so invalidating the whole cache is a single increment.
+  struct CachedProb {
+    Float p;
+    Count epoch;
+    CachedProb(): p(0), epoch(0) {}
+  };
+  static vector<CachedProb> _p_word_cache;
+  static Count _p_word_epoch;
+  static Count _p_word_hits;
+  static Count _p_word_misses;
+  static Fs _log_phoneme_ps;
+  //_log_length_ps[n] = log(alpha*p(n)) for words of length n,
+  //folding in the mass of utt boundaries in the bigram model.
+  static Fs _log_length_ps;
+  static Float compute_p_word(WordId w);
+  static Float cache_p_word(WordId w);
+  static Float fill_p_word(WordId w, Float p);
+  //call whenever alpha, p_boundary or p_utt_boundary changes.
+  static void reset_p_word();
+  //call whenever a hyperparameter changes.
+  void hyperparm_changed(bool in_base);
+  typedef unordered_map<WordId, Urn<WordId, Float> > Contexts;
+  WordId generate_word(WordId previous, const Urn<WordId, Float>& novel,
+		       Contexts& contexts) const;
+  typedef Urn<char, Float> PhonemeUrn;
+  //a word drawn from the base distribution (given the urn of its
+  //phonemes), interned if it is new.
+  WordId generate_novel_word(const PhonemeUrn& phonemes) const;
+  void novel_second_urn(Urn<WordId, Float>& words) const;
+  WordId generate_novel_second(WordId previous,
+			       const Urn<WordId, Float>& novel) const;
 };
 
 
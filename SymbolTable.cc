@@ -0,0 +1,100 @@
+#include "SymbolTable.h"
+
+SymbolTable SymbolTable::WORDS;
+const WordId SymbolTable::EDGE;
+const WordId SymbolTable::NONE;
+const size_t SymbolTable::PACKED;
+
+SymbolTable::SymbolTable() {
+  clear();
+}
+
+void
+SymbolTable::clear() {
+  _parent.assign(1, EDGE);
+  _last.assign(1, 0);
+  _length.assign(1, 0);
+  _children.clear();
+  _packed.clear();
+  _packed.insert(packed(0, 0)).first->second = EDGE;
+}
+
+// adds the new id w to the maps.
+void
+SymbolTable::index(WordId w) {
+  _children.insert(key(_parent[w], _last[w])).first->second = w;
+  if (_length[w] <= PACKED) {
+    char s[PACKED];
+    for (WordId v = w; v != EDGE; v = _parent[v])
+      s[_length[v]-1] = _last[v];
+    _packed.insert(packed(s, _length[w])).first->second = w;
+  }
+}
+
+WordId
+SymbolTable::extend(WordId prefix, char c) {
+  WordId w = find(prefix, c);
+  if (w == NONE) {
+    w = size();
+    _parent.push_back(prefix);
+    _last.push_back(c);
+    _length.push_back(_length[prefix] + 1);
+    index(w);
+  }
+  return w;
+}
+
+WordId
+SymbolTable::intern(const std::string& s) {
+  return intern(s.data(), s.size());
+}
+
+WordId
+SymbolTable::find(const std::string& s) const {
+  return find(s.data(), s.size());
+}
+
+WordId
+SymbolTable::intern(const char* s, size_t n) {
+  WordId w = find(s, n);
+  if (w != NONE)
+    return w;
+  w = EDGE;
+  for (size_t i = 0; i < n; i++)
+    w = extend(w, s[i]);
+  return w;
+}
+
+void
+SymbolTable::save(Checkpoint& c) const {
+  c.put(_parent);
+  c.put(_last);
+  c.put(_length);
+}
+
+void
+SymbolTable::restore(Checkpoint& c) {
+  c.get(_parent);
+  c.get(_last);
+  c.get(_length);
+  if (_parent.empty() || _last.size() != _parent.size() ||
+      _length.size() != _parent.size())
+    error("SymbolTable::restore(): the checkpoint is corrupt");
+  _children.clear();
+  _packed.clear();
+  _packed.insert(packed(0, 0)).first->second = EDGE;
+  for (WordId w = 1; w < size(); w++)
+    index(w);
+}
+
+std::string
+SymbolTable::str(WordId w) const {
+  if (w == EDGE) return "$$";
+  if (w >= size()) return "NOVEL";
+  std::string s(_length[w], ' ');
+  for (size_t i = s.size(); i > 0; i--) {
+    s[i-1] = _last[w];
+    w = _parent[w];
+  }
+  return s;
+}
@@ -0,0 +1,97 @@
+#ifndef _SYMBOLTABLE_H_
+#define _SYMBOLTABLE_H_
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "FlatMap.h"
+#include "Checkpoint.h"
+
+/*
+SymbolTable interns words as dense integer WordIds.  Ids are
+the nodes of a character trie: the id of a word is reached from
+the id of its prefix by one more character.  Each node remembers
+its parent, last character and length so the string can be
+recovered for output.  Id 0 is the root of the trie (the empty
+prefix); since no word is empty, we use it to stand for the
+utterance edge $$.
+
+A span of an utterance is looked up in place, with no string
+built.  Most words are short, so the words of up to PACKED chars
+are also kept by their chars packed into one key, and found with
+a single probe; a longer word goes on from its first PACKED
+chars along the trie, and stops at the first char that leaves
+it.  The sampler interns a word only when it seats it, so WORDS
+holds the words it has proposed (and their prefixes) rather than
+every span of the corpus.
+*/
+
+typedef uint32_t WordId;
+
+class SymbolTable {
+public:
+  static const WordId EDGE = 0;
+  static const WordId NONE = 0xffffffff;
+  // the table shared by all utterances in the corpus
+  static SymbolTable WORDS;
+  SymbolTable();
+  // returns id of the word formed by appending c to prefix,
+  // adding it to the table if necessary.
+  WordId extend(WordId prefix, char c);
+  // as above, but returns NONE if the word is not in the table.
+  WordId find(WordId prefix, char c) const {
+    FlatMap<uint64_t, WordId>::const_iterator i =
+      _children.find(key(prefix, c));
+    if (i == _children.end()) return NONE;
+    return i->second;
+  }
+  WordId intern(const std::string& s);
+  WordId find(const std::string& s) const;
+  // the same for the n chars from s, which are a span of an
+  // utterance.  find() stops at the first char that leaves the
+  // trie.
+  WordId intern(const char* s, size_t n);
+  WordId find(const char* s, size_t n) const {
+    size_t k = n < PACKED ? n : PACKED;
+    FlatMap<uint64_t, WordId>::const_iterator i =
+      _packed.find(packed(s, k));
+    if (i == _packed.end()) return NONE;
+    WordId w = i->second;
+    for (; k < n && w != NONE; k++)
+      w = find(w, s[k]);
+    return w;
+  }
+  // number of ids, including EDGE.
+  size_t size() const {return _parent.size();}
+  size_t length(WordId w) const {return _length[w];}
+  char last(WordId w) const {return _last[w];}
+  WordId parent(WordId w) const {return _parent[w];}
+  std::string str(WordId w) const;
+  void clear();
+  // appends the table to c, or replaces it with the one read
+  // from c.
+  void save(Checkpoint& c) const;
+  void restore(Checkpoint& c);
+private:
+  static const size_t PACKED = 7;
+  static uint64_t key(WordId prefix, char c) {
+    return ((uint64_t)prefix << 8) | (unsigned char)c;
+  }
+  // the n (at most PACKED) chars from s, and n in the top byte.
+  static uint64_t packed(const char* s, size_t n) {
+    uint64_t k = (uint64_t)n << 56;
+    for (size_t i = 0; i < n; i++)
+      k |= (uint64_t)(unsigned char)s[i] << 8*i;
+    return k;
+  }
+  std::vector<WordId> _parent;
+  std::vector<char> _last;
+  std::vector<uint32_t> _length;
+  // the edges of the trie
+  FlatMap<uint64_t, WordId> _children;
+  // the words of up to PACKED chars, by packed()
+  FlatMap<uint64_t, WordId> _packed;
+  void index(WordId w);
+};
+
+#endif
@@ -0,0 +1,92 @@
+#include "TraceWriter.h"
+
+TraceWriter::TraceWriter(const Corpus& corpus, ostream& stats_os,
+			 ostream& words_os):
+  _corpus(corpus), _stats_os(stats_os), _words_os(words_os), _done(false),
+  _thread(&TraceWriter::run, this) {}
+
+void
+TraceWriter::add(const State& state, Count iteration, bool stats,
+		 bool words, bool last) {
+  Trace* trace;
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    my_assert(!_done, iteration);
+    while (_pending.size() >= MAX_PENDING)
+      _changed.wait(lock);
+    if (_free.empty())
+      _free.push_back(new Trace);
+    trace = _free.back();
+    _free.pop_back();
+  }
+  // the copy is made outside the lock, so as not to hold up the
+  // writer.
+  trace->iteration = iteration;
+  trace->stats = stats;
+  trace->words = words;
+  trace->last = last;
+  if (stats)
+    state.get_stats(trace->state);
+  if (words)
+    trace->boundaries = _corpus.boundaries();
+  std::lock_guard<std::mutex> lock(_mutex);
+  _pending.push_back(trace);
+  _changed.notify_all();
+}
+
+void
+TraceWriter::flush() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  while (!_pending.empty())
+    _changed.wait(lock);
+  // the thread only touches the streams while something is pending.
+  _stats_os.flush();
+  _words_os.flush();
+}
+
+void
+TraceWriter::finish() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _done = true;
+    _changed.notify_all();
+  }
+  if (_thread.joinable())
+    _thread.join();
+  foreach(vector<Trace*>, t, _free)
+    delete *t;
+  _free.clear();
+}
+
+void
+TraceWriter::run() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  for (;;) {
+    while (_pending.empty() && !_done)
+      _changed.wait(lock);
+    if (_pending.empty())
+      break;
+    Trace* trace = _pending.front();
+    lock.unlock();
+    write(*trace);
+    lock.lock();
+    _pending.pop_front();
+    _free.push_back(trace);
+    _changed.notify_all();
+  }
+  _stats_os.flush();
+  _words_os.flush();
+}
+
+void
+TraceWriter::write(const Trace& trace) {
+  if (trace.stats) {
+    _stats_os << trace.iteration << ",\t";
+    trace.state.print(_stats_os);
+  }
+  if (trace.words) {
+    _corpus.print(_words_os, &trace.boundaries[0]);
+    if (!trace.last)
+      _words_os << endl;
+  }
+}
@@ -0,0 +1,66 @@
+#ifndef _TRACEWRITER_H_
+#define _TRACEWRITER_H_
+
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+#include "typedefs.h"
+#include "State.h"
+
+/*
+TraceWriter writes the trace output (the .stats and .words files)
+in a background thread.  The sampler hands it a snapshot of the
+state: a copy of the boundary bits and of State::Stats, which
+costs a memcpy and a pass over the word types.  Formatting the
+segmentation, summing the log posterior and the writing itself are
+then done while sampling goes on.  Snapshots are written in the
+order they were taken; if the writer falls MAX_PENDING behind,
+add() waits for it, so they can't pile up in memory.
+*/
+
+class TraceWriter {
+public:
+  // stats_os and words_os, and the corpus, must outlive the writer.
+  TraceWriter(const Corpus& corpus, ostream& stats_os, ostream& words_os);
+  ~TraceWriter() {finish();}
+  // writes "iteration,\t" and the stats line (if stats) to stats_os,
+  // and the segmentation (if words) to words_os, followed by a
+  // blank line unless last.
+  void add(const State& state, Count iteration, bool stats, bool words,
+	   bool last=false);
+  // waits until everything added has been written, and flushes
+  // the streams.
+  void flush();
+  // waits until everything added has been written, and stops the
+  // thread.  nothing may be added after.
+  void finish();
+private:
+  struct Trace {
+    Count iteration;
+    bool stats;
+    bool words;
+    bool last;
+    State::Stats state;
+    vector<uint64_t> boundaries;
+  };
+  static const Count MAX_PENDING = 4;
+  const Corpus& _corpus;
+  ostream& _stats_os;
+  ostream& _words_os;
+  std::deque<Trace*> _pending;
+  vector<Trace*> _free; // written, to be reused
+  bool _done;
+  std::mutex _mutex;
+  std::condition_variable _changed;
+  std::thread _thread;
+  void run();
+  void write(const Trace& trace);
+  TraceWriter(const TraceWriter&);
+  void operator=(const TraceWriter&);
+};
+
+#endif
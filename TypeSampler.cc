@@ -0,0 +1,271 @@
+#include <cstring>
+#include "TypeSampler.h"
+#include "State.h"
+
+extern Count debug_level;
+
+Count
+TypeSampler::number(Utterances& utterances) {
+  _utts.clear();
+  _offsets.clear();
+  Count nchars = 0;
+  _nsites = 0;
+  foreach(Utterances, u, utterances) {
+    _utts.push_back(&(*u));
+    _offsets.push_back(nchars);
+    nchars += u->length();
+    _nsites += u->length() - 1;
+  }
+  return nchars;
+}
+
+void
+TypeSampler::init(Utterances& utterances) {
+  Count nchars = number(utterances);
+  _visited.assign(nchars, 0);
+  _seen.assign(nchars, 0);
+  rebuild();
+}
+
+//the index is only ever looked up, so the order of its buckets
+//doesn't matter, only the order of the sites in each.
+void
+TypeSampler::save(Checkpoint& c) const {
+  c.put(!_utts.empty());
+  if (_utts.empty())
+    return;
+  c.put(_visited);
+  c.put(_seen);
+  c.put(_nentries);
+  c.put(_pass);
+  c.put(_block);
+  c.put((uint64_t)_index.size());
+  cforeach(Index, i, _index) {
+    c.put(i->first);
+    c.put(i->second.sites);
+    c.put(i->second.pass);
+    c.put(i->second.scanned);
+  }
+}
+
+void
+TypeSampler::restore(Checkpoint& c, Utterances& utterances) {
+  bool indexed;
+  c.get(indexed);
+  _index.clear();
+  _nentries = _pass = _block = 0;
+  if (!indexed) {
+    _utts.clear();
+    return;
+  }
+  number(utterances);
+  c.get(_visited);
+  c.get(_seen);
+  c.get(_nentries);
+  c.get(_pass);
+  c.get(_block);
+  uint64_t n;
+  c.get(n);
+  for (uint64_t k = 0; k < n; k++) {
+    uint64_t type;
+    c.get(type);
+    Bucket& bucket = _index[type];
+    c.get(bucket.sites);
+    c.get(bucket.pass);
+    c.get(bucket.scanned);
+  }
+}
+
+void
+TypeSampler::rebuild() {
+  _index.clear();
+  _nentries = 0;
+  for (uint32_t u = 0; u < _utts.size(); u++) {
+    for (Count i = 0; i < _utts[u]->length()-1; i++)
+      add(u, i);
+  }
+  debug_output(100, "TypeSampler::rebuild(): types = ", _index.size());
+}
+
+void
+TypeSampler::touch(uint32_t u, int prev, Count i, Count next) {
+  const Utterance& utt = *_utts[u];
+  Count last = utt.length()-2; //last site
+  //the sites inside the words around i, which are bounded by
+  //prev, next and (if it is now a boundary) i.
+  Count left_end = utt.boundary(i) ? i : next;
+  int right_start = utt.boundary(i) ? i : prev;
+  if (prev+1 < (int)i) {
+    WordId w = utt.intern_between(prev, left_end);
+    for (Count j = prev+1; j < i; j++)
+      add_in(u, w, prev, j);
+  }
+  if (i+1 < next) {
+    WordId w = utt.intern_between(right_start, next);
+    for (Count j = i+1; j < next; j++)
+      add_in(u, w, right_start, j);
+  }
+  //and the sites at the two boundaries themselves.
+  if (prev >= 0)
+    add(u, utt.prev_boundary(prev), prev, left_end);
+  if (next <= last)
+    add(u, right_start, next, utt.next_boundary(next));
+}
+
+void
+TypeSampler::sample(State& state, Utterances& utterances, Float temp) {
+  if (_utts.empty())
+    init(utterances);
+  else if (_nentries > 2*_nsites)
+    rebuild();
+  _pass++;
+  for (uint32_t u = 0; u < _utts.size(); u++) {
+    const Utterance& utt = *_utts[u];
+    for (Count i = 0; i < utt.length()-1; i++) {
+      if (_visited[_offsets[u] + i] != _pass)
+	sample_type(Site(u, i), state, temp);
+    }
+  }
+}
+
+bool
+TypeSampler::isolated(const Utterance& u, int prev, Count next) {
+  const char* w = u._unsegmented + prev + 1;
+  int len = next - prev;
+  int last = u.length() - 1 - len;
+  for (int p = max(prev - len + 1, -1); p < prev + len && p <= last; p++) {
+    if (p != prev && !memcmp(u._unsegmented + p + 1, w, len))
+      return false;
+  }
+  return true;
+}
+
+//samples site together with all the other isolated sites of its
+//type that have not been sampled yet this pass.  if site itself is
+//not isolated, it is sampled on its own.
+void
+TypeSampler::sample_type(const Site& site, State& state, Float temp) {
+  Utterance& u0 = *_utts[site.utt];
+  Count i0 = site.pos;
+  int prev;
+  Count next;
+  uint64_t type = site_type(u0, i0, prev, next);
+  _visited[_offsets[site.utt] + i0] = _pass;
+  Sites sites(1, site);
+  if (isolated(u0, prev, next)) {
+    Bucket& bucket = _index[type];
+    Sites& entries = bucket.sites;
+    _block++;
+    Count keep = (bucket.pass == _pass) ? bucket.scanned : 0;
+    for (Count k = keep; k < entries.size(); k++) {
+      Site s = entries[k];
+      const Utterance& u = *_utts[s.utt];
+      Count id = _offsets[s.utt] + s.pos;
+      if (_seen[id] == _block)
+	continue; //duplicate
+      //the type's word is in the table, so the site has the type
+      //if it has the same chars around it.
+      int p = u.prev_boundary(s.pos);
+      Count n = u.next_boundary(s.pos);
+      if ((int)s.pos - p != (int)i0 - prev || n - p != next - prev ||
+	  memcmp(u._unsegmented + p + 1, u0._unsegmented + prev + 1, n - p))
+	continue; //stale
+      _seen[id] = _block;
+      entries[keep++] = s;
+      if (_visited[id] != _pass && isolated(u, p, n)) {
+	_visited[id] = _pass;
+	sites.push_back(s);
+      }
+    }
+    _nentries -= entries.size() - keep;
+    entries.erase(entries.begin() + keep, entries.end());
+    bucket.pass = _pass;
+    bucket.scanned = keep;
+  }
+
+  Lexicon& lexicon = state.get_lexicon();
+  WordId left = u0.word_between(prev, i0);
+  WordId right = u0.word_between(i0, next);
+  WordId center = type >> 32; //interned by site_type()
+  Count m = sites.size();
+  Bs old(m);
+  for (Count k = 0; k < m; k++) {
+    old[k] = _utts[sites[k].utt]->boundary(sites[k].pos);
+    if (old[k]) {
+      lexicon.dec(left);
+      lexicon.dec(right);
+    }
+    else
+      lexicon.dec(center);
+  }
+  //p(b boundaries) = C(m,b) * the prob of any one way of adding
+  //b lefts, b rights, m-b centers and b more continuations to the
+  //lexicon.  we build it up from the ratio p(b+1)/p(b).  only the
+  //second factor is annealed, since the C(m,b) arrangements are
+  //distinct states.  with m = 1 this is Utterance::sample_one().
+  Float n = lexicon.ntokens();
+  Float denom = n + state.alpha();
+  Float conts = n + m - state.nutterances() + state.beta()/2;
+  Float events = n + m + state.beta();
+  Float x_left = lexicon(left) + u0.p_word(prev, i0, left, lexicon);
+  Float x_right = lexicon(right) + u0.p_word(i0, next, right, lexicon);
+  Float x_center = lexicon(center) + u0.p_word(prev, next, center, lexicon);
+  bool same = u0.same_words(left, right, prev, i0, next);
+  //ps[b] is kept relative to ps[0], and rescaled if it gets huge;
+  //if it gets tiny it does not matter.
+  Fs ps(m+1);
+  ps[0] = 1;
+  for (Count b = 0; b < m; b++) {
+    Float r = (conts + b) / (events + b) /
+      (denom + m + b) / (x_center + (m-b-1));
+    if (same)
+      r *= (x_left + 2*b) * (x_left + 2*b + 1);
+    else
+      r *= (x_left + b) * (x_right + b);
+    if (temp != 1)
+      r = pow(r, temp);
+    if (r > 1e250) //p_word() of a very long center can underflow to 0
+      r = 1e250;
+    ps[b+1] = ps[b] * r * (m-b) / (b+1);
+    if (ps[b+1] > 1e250) {
+      for (Count c = 0; c <= b+1; c++)
+	ps[c] *= 1e-250;
+    }
+  }
+  Float total = 0;
+  for (Count b = 0; b <= m; b++)
+    total += ps[b];
+  Float r = randd()*total;
+  Count nyes = 0;
+  while (nyes < m && r >= ps[nyes]) {
+    r -= ps[nyes];
+    nyes++;
+  }
+  debug_output(600, "TypeSampler::sample_type(): (m, b) = ", CC(m, nyes));
+  //choose which sites get the boundaries
+  for (Count k = 0; k < nyes; k++) {
+    Count j = k + (Count)(randd()*(m-k));
+    if (j >= m) j = m-1;
+    swap(sites[k], sites[j]);
+    Bs::swap(old[k], old[j]);
+  }
+  for (Count k = 0; k < m; k++) {
+    bool yes = (k < nyes);
+    Utterance& u = *_utts[sites[k].utt];
+    if (yes) {
+      left = u0.seat(prev, i0, left, lexicon);
+      right = u0.seat(i0, next, right, lexicon);
+    }
+    else
+      center = u0.seat(prev, next, center, lexicon);
+    if (yes != old[k])
+      u.set_boundary(sites[k].pos, yes);
+  }
+  for (Count k = 0; k < m; k++) {
+    if ((k < nyes) == old[k])
+      continue;
+    const Utterance& u = *_utts[sites[k].utt];
+    Count i = sites[k].pos;
+    touch(sites[k].utt, u.prev_boundary(i), i, u.next_boundary(i));
+  }
+}
@@ -0,0 +1,115 @@
+#ifndef _TYPESAMPLER_H_
+#define _TYPESAMPLER_H_
+
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+#include "typedefs.h"
+#include "Utterance.h"
+#include "Checkpoint.h"
+
+/*
+TypeSampler resamples boundaries a type at a time (unigram model
+only).  A site is a position where a boundary may go; its type is
+the word that spans it when there is no boundary there, plus the
+point where a boundary would split that word.  Under the unigram
+model all sites of one type are exchangeable, so rather than
+flipping them one by one we remove them all from the lexicon, draw
+the number of them that get a boundary in one step, and choose
+which ones uniformly.  This lets a frequent word that is glued
+together (or split) everywhere change in a single move.  Sites
+whose word overlaps another occurrence of itself (zd|zd|zd) are
+left out of these moves and sampled on their own, since which of
+them have the type depends on the boundaries being resampled.
+
+The index maps each type to the sites that have it.  A boundary
+change only alters the types of the sites within the words on
+either side of it, and those sites are pushed onto the buckets for
+their new types as they change.  Old entries are not removed; an
+entry is simply skipped (and dropped) if its site no longer has
+the bucket's type, and the whole index is rebuilt once stale
+entries outnumber live ones.  So a pass costs about as much as an
+ordinary sweep, plus the re-indexing of the sites near each
+boundary that actually changes.
+*/
+
+using namespace std;
+class State;
+
+class TypeSampler {
+public:
+  TypeSampler(): _nsites(0), _nentries(0), _pass(0), _block(0) {}
+  //sample every site once, a type at a time, using annealing
+  //temperature temp.  the index is built on the first call.
+  void sample(State& state, Utterances& utterances, Float temp=1);
+  void save(Checkpoint& c) const;
+  void restore(Checkpoint& c, Utterances& utterances);
+private:
+  struct Site {
+    uint32_t utt;
+    uint32_t pos;
+    Site(): utt(0), pos(0) {}
+    Site(uint32_t u, uint32_t i): utt(u), pos(i) {}
+  };
+  typedef vector<Site> Sites;
+  //sites are only ever appended, so once a bucket has been scanned
+  //in a pass, a later block of the same type in that pass need
+  //only look at the sites added since.
+  struct Bucket {
+    Sites sites;
+    Count pass;    //pass in which it was last scanned
+    Count scanned; //number of sites scanned then
+    Bucket(): pass(0), scanned(0) {}
+  };
+  typedef unordered_map<uint64_t, Bucket> Index;
+  vector<Utterance*> _utts;
+  Cs _offsets; //index of each utterance's first char in the arrays below
+  Cs _visited; //pass in which each site was last sampled
+  Cs _seen;    //last block in which each site was found in its bucket
+  Index _index;
+  Count _nsites;
+  Count _nentries; //live and stale
+  Count _pass;
+  Count _block;
+  //the type of site i; also sets the boundaries around it.  the
+  //word is added to the table if it is new, so that its sites
+  //share an id.
+  static uint64_t site_type(const Utterance& u, Count i,
+			    int& prev, Count& next) {
+    prev = u.prev_boundary(i);
+    next = u.next_boundary(i);
+    return ((uint64_t)u.intern_between(prev, next) << 32) | (i - prev);
+  }
+  static uint64_t site_type(const Utterance& u, Count i) {
+    int prev;
+    Count next;
+    return site_type(u, i, prev, next);
+  }
+  void init(Utterances& utterances);
+  //sets _utts, _offsets and _nsites; returns the number of chars.
+  Count number(Utterances& utterances);
+  void rebuild();
+  //index site i, whose neighbouring boundaries are prev and next.
+  void add(uint32_t u, int prev, Count i, Count next) {
+    add_in(u, _utts[u]->intern_between(prev, next), prev, i);
+  }
+  //the same, given w, the id of the word between them.
+  void add_in(uint32_t u, WordId w, int prev, Count i) {
+    _index[((uint64_t)w << 32) | (i - prev)].sites.push_back(Site(u, i));
+    _nentries++;
+  }
+  void add(uint32_t u, Count i) {
+    add(u, _utts[u]->prev_boundary(i), i, _utts[u]->next_boundary(i));
+  }
+  //re-index the sites whose type changes when the boundary at
+  //site i (between prev and next) has been flipped.
+  void touch(uint32_t u, int prev, Count i, Count next);
+  //true if no other occurrence of the word between prev and next
+  //overlaps it.  two sites of the same type can only share chars
+  //if their words overlap like this, and then whether one of them
+  //has the type depends on the boundary at the other.
+  static bool isolated(const Utterance& u, int prev, Count next);
+  void sample_type(const Site& site, State& state, Float temp);
+};
+
+#endif
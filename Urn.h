@@ -6,8 +6,15 @@
 // An urn holds a sequence of objects, each of which is
 // associated with some weight.
 //
-// You create an urn object, set ts to contain a set of
-// objects and weights, and then call sum_weights().
+// You create an urn object, push() the objects and their
+// weights, and then call draw().  An urn that will be drawn
+// from many times can call build_alias() first, after which
+// each draw is O(1) (Walker's alias method, as set up by Vose).
+//
+// clear() keeps the storage, so an urn that is refilled and
+// reused stops allocating once it has grown to its largest
+// size.  scratch() gives each thread such an urn for one-shot
+// draws.
 //
 #ifndef URN_H
 #define URN_H
@@ -18,44 +25,35 @@
 #include "utils.h"
 
 //! An urn simulates random draws of objects from a set of objects, each of
-//! which has a positive weight.
-//!
-//! To use an urn, set ts to the (object,weight) pairs, call sum_weights() and
-//! then call draw().
+//! which has a nonnegative weight.
 //
-template <typename object_type, typename weight_type> 
+template <typename object_type, typename weight_type>
 class Urn {
 
 private:
 
-  struct tuple {
-    object_type object;       //!< object in the urn, set by user
-    weight_type weight;       //!< numerical weight of object, set by user
-    weight_type sum_weight;   //!< sum of descendant's weights, set by sum_weights()
-
-    tuple(const object_type& o, const weight_type& w = weight_type())
-      : object(o), weight(w), sum_weight(0) 
-    { }  // urn::tuple::tuple()
-  };  // urn::tuple{}
-
   typedef double Float;
-  typedef std::vector<tuple> tuples;
-  tuples ts;
-
-  //! uniform() returns a random number in [0,1)
-  //
-  Float uniform() const {
-    return std::rand()/(RAND_MAX+1.0);
-  }  // urn::uniform
+  std::vector<object_type> _objects;
+  std::vector<weight_type> _sums;    //!< _sums[i] = weights of objects 0..i
+  bool _alias;                       //!< true once build_alias() is current
+  std::vector<Float> _prob;          //!< alias table: keep object i w/ prob _prob[i]
+  std::vector<size_t> _alias_index;  //!< alias table: else take this object
+  std::vector<size_t> _small, _large; //!< work lists for build_alias()
 
 public:
 
-  Urn() { }
-  Urn(size_t n) : ts(n) { }
+  Urn(): _alias(false) { }
 
-  size_t size() { return ts.size(); }
+  size_t size() const { return _objects.size(); }
+  bool empty() const { return _objects.empty(); }
 
-  void resize(size_t n) { ts.resize(n); }
+  //! clear() removes all the objects, but keeps the storage
+  //
+  void clear() {
+    _objects.clear();
+    _sums.clear();
+    _alias = false;
+  }
 
   //! push() adds a new item to the urn
   //
@@ -63,69 +61,117 @@ public:
     push(p.first, p.second);
   }
   void push(const object_type& object, const weight_type& weight=1) {
-    tuple t(object, weight);
-    if (ts.empty()) {
-      t.sum_weight = weight;
-    }
-    else {
-      t.sum_weight = ts.back().sum_weight + weight;
-    }
-    ts.push_back(t);
+    _objects.push_back(object);
+    _sums.push_back(_sums.empty() ? weight : _sums.back() + weight);
+    _alias = false;
   }  // urn::push()
 
   //! reserve() reserves space for n objects (but does not create them)
   //
-  void reserve(size_t n) { ts.reserve(n); }
+  void reserve(size_t n) {
+    _objects.reserve(n);
+    _sums.reserve(n);
+  }
 
-  //! draw() returns an object randomly drawn from the urn
+  //! draw() returns an object randomly drawn from the urn, using
+  //! random numbers from rng (by default, the current thread's).
   //
-  object_type& draw() {
-    assert(ts.size() > 0);
-    Float weight = ts.back().sum_weight*uniform();
-    //    if (DEBUG > 100)
-    //      std::cerr << "weight is " << weight << std::endl;
-    assert(weight < ts.back().sum_weight);
-    if (weight < ts[0].weight)
-      return ts[0].object;
-    return ts[draw(0, ts.size()-1, weight)].object;
+  const object_type& draw(Rng& rng) const {
+    assert(_objects.size() > 0);
+    if (_alias) {
+      Float u = rng.uniform() * _prob.size();
+      size_t i = (size_t)u;
+      return (u - i < _prob[i]) ? _objects[i] : _objects[_alias_index[i]];
+    }
+    return _objects[search(_sums.back()*rng.uniform())];
   }  // urn::draw()
+  const object_type& draw() const {
+    return draw(thread_rng());
+  }
+
+  //! build_alias() sets up the alias table, so that draw() no
+  //! longer searches.  pushing another object turns it off again.
+  //
+  void build_alias();
+
+  const weight_type& sum_weights() const {
+    return _sums.back();
+  }
 
-  const weight_type& sum_weights() {
-    return ts.back().sum_weight;
+  //! a urn private to the calling thread, for one-shot draws.
+  //! clear() it before use; don't hold on to it across calls
+  //! that may use it themselves.
+  //
+  static Urn& scratch() {
+    static thread_local Urn urn;
+    return urn;
   }
 
   friend ostream& operator<< (ostream& os, const Urn<object_type, weight_type>& u) {
-    typename Urn<object_type, weight_type>::tuples::const_iterator t;
-    for (t = u.ts.begin(); t != u.ts.end(); t++) {
-      os << "(" << t->object << "," << t->weight << ") ";
+    for (size_t i = 0; i < u._objects.size(); i++) {
+      os << "(" << u._objects[i] << "," << u.weight(i) << ") ";
     }
     os << endl;
     return os;
   }
 private:
 
-  // do a binary search to find the object whose total
-  // weight is just > weight.  Returns object index.
-  size_t draw(size_t lower, size_t upper, Float weight) const {
-    my_assert(lower >= 0, lower);
-    my_assert(upper < ts.size(), upper);
-    if (upper - lower == 1) {
-      my_assert(ts[lower].sum_weight <= weight, ts[lower].sum_weight);
-      my_assert(ts[upper].sum_weight > weight, ts[upper].sum_weight);
-      //      std::cout << ts[lower].sum_weight << " " << ts[upper].sum_weight << std::endl;
-      return upper;
-    }
-    else {
-      size_t middle = (upper - lower)/2 + lower;
-      if (ts[middle].sum_weight > weight) {
-	return draw(lower, middle, weight);
-      }
-      else {
-	return draw(middle, upper, weight);
-      }
+  weight_type weight(size_t i) const {
+    return i ? _sums[i] - _sums[i-1] : _sums[0];
+  }
+
+  // find the first object whose total weight is > w.  the loop
+  // halves the range without branching on the comparison.
+  size_t search(Float w) const {
+    const weight_type* base = &_sums[0];
+    size_t n = _sums.size();
+    while (n > 1) {
+      size_t half = n / 2;
+      base = (base[half-1] > w) ? base : base + half;
+      n -= half;
     }
-  }  // urn::draw()
-	
+    return base - &_sums[0];
+  }  // urn::search()
+
 }; // urn{}
 
+template <typename object_type, typename weight_type>
+void
+Urn<object_type, weight_type>::build_alias() {
+  assert(_objects.size() > 0);
+  size_t n = _objects.size();
+  Float scale = n / Float(_sums.back());
+  _prob.resize(n);
+  _alias_index.resize(n);
+  _small.clear();
+  _large.clear();
+  for (size_t i = 0; i < n; i++) {
+    _prob[i] = weight(i) * scale;
+    _alias_index[i] = i;
+    if (_prob[i] < 1)
+      _small.push_back(i);
+    else
+      _large.push_back(i);
+  }
+  // pair each small column with a large one, which gives up
+  // the rest of the small column's height.
+  while (!_small.empty() && !_large.empty()) {
+    size_t s = _small.back();
+    _small.pop_back();
+    size_t l = _large.back();
+    _alias_index[s] = l;
+    _prob[l] -= 1 - _prob[s];
+    if (_prob[l] < 1) {
+      _large.pop_back();
+      _small.push_back(l);
+    }
+  }
+  // what is left is 1 up to rounding.
+  for (size_t i = 0; i < _small.size(); i++)
+    _prob[_small[i]] = 1;
+  for (size_t i = 0; i < _large.size(); i++)
+    _prob[_large[i]] = 1;
+  _alias = true;
+}
+
 #endif // URN_H
@@ -2,6 +2,7 @@
 #include "Utterance.h"
 #include "State.h"
 #include "Urn.h"
+#include "Profile.h"
 
 int Utterance::_init = -1;
 extern Count debug_level;
@@ -24,85 +25,62 @@ Utterance::set_init(string b_init) {
 
 //p_segment is prob of a point being a wd boundary
 // in random segmentation.
-Utterance::Utterance(const string& reference, Float p_segment)
-  :_reference(reference), _score(-1)
-{
+void
+Utterance::init_boundaries(Float p_segment) {
   assert((p_segment >= 0) && (p_segment < 1));
   my_assert((_init >= RAN_INIT) && (_init <= TRUE_INIT), _init);
-  string word;
-  // remove SENTINEL character to create _unsegmented
-  // and create list of words for _reference_words
-  for (string::const_iterator iter = _reference.begin();
-       iter != _reference.end(); iter++) {
-    if (*iter == SENTINEL) { //end of reference word
-      my_assert(!word.empty(), _reference);
-      _reference_words.push_back(word);
-      word.clear();
-      if (_init == TRUE_INIT) {
-	_boundaries.back() = Boundary(true);
-      }
+  for (Count k = 0; k < nblocks(); k++)
+    _boundaries[k] = (_init == TRUE_INIT) ? _reference[k] : 0;
+  for (Count i = 0; i < _length; i++) {
+    if (_init == PHO_INIT) {  //initialize with all boundaries
+      set_boundary(i, true);
     }
-    else {
-      word += *iter;
-      _unsegmented += *iter;
-      if (_init == TRUE_INIT) {
-	_boundaries.push_back(Boundary(false));
-      }
-      else if (_init == UTT_INIT) {     //initialize with no boundaries
-	_boundaries.push_back(Boundary(false));
-      }
-      else if (_init == PHO_INIT) {  //initialize with all boundaries
-	_boundaries.push_back(Boundary(true));
-      }
-      else { //add random SENTINEL chars
-	double val = double(rand())/RAND_MAX;
-	if (val < p_segment) {
-	  _boundaries.push_back(Boundary(true));
-	}
-	else {
-	  _boundaries.push_back(Boundary(false));
-	}
+    else if (_init == RAN_INIT) { //add random boundaries
+      double val = randd();
+      if (val < p_segment) {
+	set_boundary(i, true);
       }
     }
+    //TRUE_INIT and UTT_INIT start with no (other) boundaries
   }
-  _boundaries.back() = Boundary(true, true); // change final position b/c always a boundary
-  assert(_boundaries.size() == _unsegmented.length());
+  set_boundary(_length-1, true); // change final position b/c always a boundary
+}
+
+void
+Utterance::init_log_phones(const Fs& log_phoneme_ps) {
+  _log_phones[0] = 0;
+  for (Count i = 0; i < _length; i++)
+    _log_phones[i+1] = _log_phones[i] +
+      log_phoneme_ps[(unsigned char)_unsegmented[i]];
 }
 
 void 
 Utterance::add_counts_to_lex(Lexicon& word_counts, BiLexicon& bg_counts, Count model) {
-  Count beg = 0;
-  Count pos = 0;
-  string prev(U_EDGE);
-  string curr;
-  foreach(Boundaries, b, _boundaries) {
-    if (b->yes) {
-      curr = _unsegmented.substr(beg, pos-beg+1);
+  int beg = -1;
+  WordId prev = U_EDGE;
+  WordId curr;
+  for (Count pos = 0; pos < _length; pos++) {
+    if (boundary(pos)) {
+      curr = intern_between(beg, pos);
       word_counts.inc(curr);
       if (model > 1)
-	b->table = bg_counts.inc(Bigram(prev,curr));
-      beg = pos+1;
+	bg_counts.inc(Bigram(prev,curr));
+      beg = pos;
       prev = curr;
     }
-    pos++;
   }
   if (model > 1)
-    _boundaries.back().final_table = bg_counts.inc(Bigram(prev,U_EDGE));
+    bg_counts.inc(Bigram(prev,U_EDGE));
 }
 
 //builds a string with SENTINEL at boundary pts.
 string
-Utterance::get_segmented() const {
+Utterance::segmentation(const uint64_t* bits) const {
   string segm;
-  Count beg = 0;
-  Count pos = 0;
-  cforeach(Boundaries, b, _boundaries) {
-    if (b->yes) {
-      segm += _unsegmented.substr(beg, pos-beg+1);
+  for (Count pos = 0; pos < _length; pos++) {
+    segm += _unsegmented[pos];
+    if ((bits[pos >> 6] >> (pos & 63)) & 1)
       segm += SENTINEL;
-      beg = pos+1;
-    }
-    pos++;
   }
   return segm;
 }
@@ -110,44 +88,231 @@ Utterance::get_segmented() const {
 
 //builds a list of words
 Utterance::Words
-Utterance::get_segmented_words() {
+Utterance::words(const uint64_t* bits) const {
   Words words;
   Count beg = 0;
-  Count pos = 0;
-  string word;
-  cforeach(Boundaries, b, _boundaries) {
-    if (b->yes) {
-      word = _unsegmented.substr(beg, pos-beg+1);
-      my_assert(!word.empty(), _unsegmented);
-      words.push_back(word);
-      //      cout << word << endl;
-      word.clear();
+  for (Count pos = 0; pos < _length; pos++) {
+    if ((bits[pos >> 6] >> (pos & 63)) & 1) {
+      words.push_back(string(_unsegmented + beg, pos-beg+1));
       beg = pos+1;
     }
-    pos++;
   }
   return words;
 }
 
-// use annealing temperature
-void 
-Utterance::sample(State& state, Float temp, Count model) {
-  if (_unsegmented.size() == 1) 
-    return;
-  if (model == 2) {
-  for (Count i = 0; i < _boundaries.size()-1; i++) {
-    sample_bigram(i,state,temp);
+//sample single boundaries, with annealing temperature temp.
+// final boundary posn must always be true, so don't sample it.
+template <int NGRAM, bool ANNEAL>
+void
+Utterance::sample(State& state, Float temp) {
+  Lexicon& lexicon = state.get_lexicon();
+  WordId center = SymbolTable::EDGE;
+  for (Count i = 0; i + 1 < _length; i++) {
+    if (NGRAM == 2)
+      sample_bigram<ANNEAL>(i,state,temp);
+    else
+      center = sample_one<ANNEAL>(i,center,lexicon,state,temp);
   }
+}
+
+void
+Utterance::sample(LocalLexicon& lexicon, const State& state, Float temp) {
+  WordId center = SymbolTable::EDGE;
+  if (temp == 1) {
+    for (Count i = 0; i + 1 < _length; i++)
+      center = sample_one<false>(i,center,lexicon,state,temp);
+  }
+  else {
+    for (Count i = 0; i + 1 < _length; i++)
+      center = sample_one<true>(i,center,lexicon,state,temp);
+  }
+}
+
+Float
+Utterance::block_weight(Count i, Count j, WordId w, const Lexicon& lexicon,
+			Float denom, Float p_cont) const {
+  return (lexicon(w) + p_word(i-1, j-1, w, lexicon)) / denom * p_cont;
+}
+
+void
+Utterance::words_from(Count max_len, Cs& at, vector<WordId>& ids) const {
+  const SymbolTable& words = SymbolTable::WORDS;
+  at.resize(_length+1);
+  ids.clear();
+  for (Count i = 0; i < _length; i++) {
+    at[i] = ids.size();
+    WordId w = SymbolTable::EDGE;
+    for (Count j = i; j < _length && j - i < max_len; j++) {
+      w = words.find(w, _unsegmented[j]);
+      if (w == SymbolTable::NONE) break;
+      ids.push_back(w);
+    }
   }
-  else { 
-  //sample single boundaries
-  // final boundary posn must always be true, so don't sample it.
-  for (Count i = 0; i < _boundaries.size()-1; i++) {
-    sample_one(i,state,temp);
+  at[_length] = ids.size();
+}
+
+/*
+Blocked sampler for the unigram model.  The utterance's words are
+removed from the lexicon, and a new segmentation is proposed from
+the distribution in which each word is drawn independently from the
+predictive distribution of the remaining counts: a forward pass sums
+over all segmentations into words of at most max_length chars, and a
+backward pass samples one.  Words within an utterance are not really
+independent (each one adds to the counts seen by the next), so the
+proposal is accepted with the Metropolis-Hastings ratio, using the
+exact sequential probabilities.  If the current segmentation has a
+word longer than max_length it cannot be proposed, and we always move.
+*/
+void
+Utterance::sample_block(State& state, Float temp, Count max_length) {
+  Count n = _length;
+  if (n == 1)
+    return;
+  Lexicon& lexicon = state.get_lexicon();
+  Count max_len = (max_length && max_length < n) ? max_length : n;
+  Cs old_ends;
+  bool old_ok = true;
+  int prev = -1;
+  for (Count i = 0; i < n; i++) {
+    if (boundary(i)) {
+      lexicon.dec(word_between(prev, i));
+      old_ends.push_back(i);
+      if (i - prev > max_len) old_ok = false;
+      prev = i;
+    }
   }
+  Cs at;
+  vector<WordId> ids;
+  words_from(max_len, at, ids);
+  Count nutts = state.nutterances() - 1;
+  Float denom = lexicon.ntokens() + State::alpha();
+  Float p_cont = State::p_cont2(lexicon.ntokens(), nutts);
+  // forward: log_alpha[j] is the log of the total weight of
+  // all segmentations of chars 0..j-1.  we work with the ratios
+  // alpha[i]/alpha[j-1], built up by multiplying by ratio[k] =
+  // alpha[k-1]/alpha[k], so there is no exp per term.  if a ratio
+  // gets too big to trust (very long spans), redo j in log space.
+  Fs log_alpha(n+1), ratio(n+1);
+  log_alpha[0] = 0;
+  for (Count j = 1; j <= n; j++) {
+    Count lo = (j > max_len) ? j - max_len : 0;
+    Float sum = 0, scale = 1;
+    bool scaled = true;
+    for (Count i = j-1; ; i--) {
+      Float w = block_weight(i, j, word_from(i, j, at, ids), lexicon,
+			     denom, p_cont);
+      if (temp != 1) w = pow(w, temp);
+      sum += scale * w;
+      if (i == lo) break;
+      scale *= ratio[i];
+      if (scale > 1e250) {
+	scaled = false;
+	break;
+      }
+    }
+    if (scaled && sum > 0) {
+      log_alpha[j] = log_alpha[j-1] + log(sum);
+      ratio[j] = 1/sum;
+      continue;
+    }
+    Fs terms(j-lo);
+    Float m = -HUGE_VAL;
+    for (Count i = lo; i < j; i++) {
+      Float w = block_weight(i, j, word_from(i, j, at, ids), lexicon,
+			     denom, p_cont);
+      terms[i-lo] = log_alpha[i] + temp*log(w);
+      m = max(m, terms[i-lo]);
+    }
+    sum = 0;
+    for (Count i = lo; i < j; i++)
+      sum += exp(terms[i-lo] - m);
+    log_alpha[j] = m + log(sum);
+    ratio[j] = exp(log_alpha[j-1] - log_alpha[j]);
+  }
+  // backward: sample the start of each word, right to left.
+  Cs new_ends;
+  Fs weights(max_len);
+  Count j = n;
+  while (j > 0) {
+    Count lo = (j > max_len) ? j - max_len : 0;
+    Float total = 0;
+    for (Count i = lo; i < j; i++) {
+      Float w = block_weight(i, j, word_from(i, j, at, ids), lexicon,
+			     denom, p_cont);
+      if (temp != 1) w = pow(w, temp);
+      weights[i-lo] = exp(log_alpha[i] - log_alpha[j]) * w;
+      total += weights[i-lo];
+    }
+    Float r = randd()*total;
+    Count i = lo;
+    while (i < j-1 && r >= weights[i-lo]) {
+      r -= weights[i-lo];
+      i++;
+    }
+    new_ends.push_back(j-1);
+    j = i;
+  }
+  reverse(new_ends.begin(), new_ends.end());
+  bool accept = true;
+  if (old_ok && new_ends != old_ends) {
+    Float log_q_new = 0;
+    Float log_q_old = 0;
+    prev = -1;
+    cforeach(Cs, e, new_ends) {
+      log_q_new += log(block_weight(prev+1, *e+1,
+				    word_from(prev+1, *e+1, at, ids),
+				    lexicon, denom, p_cont));
+      prev = *e;
+    }
+    prev = -1;
+    cforeach(Cs, e, old_ends) {
+      log_q_old += log(block_weight(prev+1, *e+1,
+				    word_from(prev+1, *e+1, at, ids),
+				    lexicon, denom, p_cont));
+      prev = *e;
+    }
+    Float log_r = temp * (log_sequential(new_ends, lexicon, nutts) -
+			  log_sequential(old_ends, lexicon, nutts) -
+			  log_q_new + log_q_old);
+    debug_output(500, "Utterance::sample_block() log MH ratio = ", log_r);
+    accept = (log_r >= 0) || (randd() < exp(log_r));
+  }
+  const Cs& ends = accept ? new_ends : old_ends;
+  fill(_boundaries, _boundaries + nblocks(), 0);
+  prev = -1;
+  cforeach(Cs, e, ends) {
+    set_boundary(*e, true);
+    lexicon.inc(intern_between(prev, *e));
+    prev = *e;
   }
 }
 
+// The probability of continuing after each word follows the
+// same Beta-Bernoulli scheme as log_posterior(), treating this
+// utterance as the last of nutts+1.
+Float
+Utterance::log_sequential(const Cs& ends, Lexicon& lexicon,
+			  Count nutts) const {
+  Float log_p = 0;
+  int prev = -1;
+  for (Count k = 0; k < ends.size(); k++) {
+    WordId wd = intern_between(prev, ends[k]);
+    Float p_cont = State::p_cont2(lexicon.ntokens(), nutts);
+    if (k == ends.size() - 1)
+      p_cont = 1 - p_cont;
+    log_p += log(p_cont * (lexicon(wd) + p_word(prev, ends[k])) /
+		 (lexicon.ntokens() + State::alpha()));
+    lexicon.inc(wd);
+    prev = ends[k];
+  }
+  prev = -1;
+  cforeach(Cs, e, ends) {
+    lexicon.dec(word_between(prev, *e));
+    prev = *e;
+  }
+  return log_p;
+}
+
 /*log posterior in unigram model
 nutts is number of utts seen so far.
 lexicon is words seen so far.
@@ -157,27 +322,27 @@ the lexicon used in the calculation.
 Float
 Utterance::log_posterior(Count nutts, Lexicon& lexicon, const State& state) const {
   debug_output(800, "Utterance::log_posterior:\n", *this);
-  string wd;
+  int prev = -1; // previous boundary
   Float prob = 0; //log prob
-   for (Count i = 0; i < _boundaries.size(); i++) {
-    wd += _unsegmented[i];
-    if (_boundaries[i].yes) {
+   for (Count i = 0; i < _length; i++) {
+    if (boundary(i)) {
+      WordId wd = word_between(prev, i);
       Float p_cont = State::p_cont2(lexicon.ntokens(), nutts);
       Float p;
       // S -> W S
-      if (i < _boundaries.size() - 1)
+      if (i < _length - 1)
 	p = p_cont;
       //S -> W
       else
 	p = 1-p_cont;
       // W -> x_1 .. x_n
       //calcs for non-unique lexicon
-      Float q = (lexicon(wd) + State::p_word(wd))/
+      Float q = (lexicon(wd) + p_word(prev, i))/
 	(lexicon.ntokens() + State::alpha());
       typedef pair<string, FF> SFF;
-      debug_output(800, "Utterance::log_posterior() (w, (p(w), p(utt_b))) = ", SFF(wd,FF(q,p)));
+      debug_output(800, "Utterance::log_posterior() (w, (p(w), p(utt_b))) = ", SFF(SymbolTable::WORDS.str(wd),FF(q,p)));
       prob += log(p*q);
-      debug_output(800, "Utterance::log_posterior() (w, log(p(w)*p(utt_b))) = ", SF(wd,log(p*q)));
+      debug_output(800, "Utterance::log_posterior() (w, log(p(w)*p(utt_b))) = ", SF(SymbolTable::WORDS.str(wd),log(p*q)));
       /* //calcs for unique lexicon
       if (lexicon(wd))
 	prob += log(lexicon(wd)/(lexicon.ntokens() + State::alpha()));
@@ -185,7 +350,7 @@ Utterance::log_posterior(Count nutts, Lexicon& lexicon, const State& state) cons
 	prob += log(State::p_word(wd)/(lexicon.ntokens() + State::alpha()));
       */
       lexicon.inc(wd);
-      wd = "";
+      prev = i;
     }
   }
   return prob;
@@ -198,98 +363,121 @@ bilex is bigrams seen so far.
 We use the static functions so that we can specify
 the lexicon used in the calculation.
 Note that this returns the probability of the current
-*segmentation*, summing over assignments to bigram tables.
+segmentation and table sizes in state.  Tokens don't remember
+their tables, so each one goes to the table given by
+Restaurant::fill_size(); any assignment with the same sizes
+has the same prob.
 */
 Float
 Utterance::log_posterior(Count nutts, Lexicon& lexicon, BiLexicon& bilex, const State& state) const {
   debug_output(800, "Utterance::log_posterior:\n", *this);
-  string wd;
-  string prev(U_EDGE); // previous word
+  int beg = -1; // previous boundary
+  WordId prev = U_EDGE; // previous word
   Count prev_count = nutts; // count of previous word.  At start of utt, equals number of $$.
   Float prob = 0; //log prob
-   for (Count i = 0; i < _boundaries.size(); i++) {
-    wd += _unsegmented[i];
-    if (_boundaries[i].yes) {
+   for (Count i = 0; i < _length; i++) {
+    if (boundary(i)) {
+      WordId wd = word_between(beg, i);
       // S_ij -> W_jk S_jk
       Bigram bg(prev,wd);
-      Count table = _boundaries[i].table;
+      Count table = state.get_bilexicon().fill_size(bg, bilex(bg));
       prob += log(joint_predictive_dist(bg, prev_count, bilex, table));
       debug_output(800, "Utterance::log_posterior() log_p = ", prob);
       // context count for next word should not include this instance,
       //so get count before incrementing unigram stats.
       prev_count = lexicon(wd); 
       lexicon.inc(wd);
-      bilex.place(bg, table, 1); //use "unsafe" mode to allow table placement out of order
+      bilex.place(bg, table);
       prev = wd;
-      wd = "";
+      beg = i;
     }
   }
   //S_jk -> $
    Bigram bg(prev,U_EDGE);
-   Count table = _boundaries.back().final_table;
+   Count table = state.get_bilexicon().fill_size(bg, bilex(bg));
    prob += log(joint_predictive_dist(bg, prev_count, bilex, table));
    debug_output(800, "Utterance::log_posterior() log_p = ", prob);
-   bilex.place(bg, table, 1); //use "unsafe" mode to allow table placement out of order
+   bilex.place(bg, table);
    return prob;
 }
 
+//w^temp, where ANNEAL is false only if temp is 1.
+template <bool ANNEAL>
+static inline Float
+anneal(Float w, Float temp) {
+  return ANNEAL ? pow(w, temp) : w;
+}
+
 //samples a single boundary point at position i
 //with temperature temp.
-void
-Utterance::sample_one(Count i, State& state, Float temp) {
-  Lexicon& lexicon = state.get_lexicon();   
-  string left = left_word(i);  
-  string right = right_word(i);
-  string center = center_word(i);
-  if (_boundaries[i].yes) {
+template <bool ANNEAL, class Lex>
+WordId
+Utterance::sample_one(Count i, WordId center, Lex& lexicon,
+		      const State& state, Float temp) {
+  int prev = prev_boundary(i);
+  Count next = next_boundary(i);
+  WordId left = word_between(prev, i, lexicon);
+  WordId right = word_between(i, next, lexicon);
+  if (center == SymbolTable::EDGE)
+    center = word_between(prev, i, next, left, lexicon);
+  bool timed = Profile::start_site();
+  if (boundary(i)) {
     lexicon.dec(left);
     lexicon.dec(right);
   }
   else {
     lexicon.dec(center);
   }
+  if (timed) Profile::step(Profile::PREDICTIVE);
   Float denom = (lexicon.ntokens()+ state.alpha());
-  Float yes = state.p_cont() * 
-    numer_base(left,state) * //denom cancels w/ no case
-    (numer_base(right,state) + kdelta(left,right)) / (denom+1);
-  Float no = numer_base(center,state); //denom cancels w/ yes case
+  Float p_cont = State::p_cont(lexicon.ntokens(), state.nutterances());
+  Float yes = p_cont * 
+    numer_base(prev,i,left,lexicon) * //denom cancels w/ no case
+    (numer_base(i,next,right,lexicon) +
+     same_words(left,right,prev,i,next)) / (denom+1);
+  Float no = numer_base(prev,next,center,lexicon); //denom cancels w/ yes case
 #ifndef NDEBUG
-  if (debug_level >= 550) cout << "p_cont: " << state.p_cont() << " denom: " << denom << endl;
-  if (debug_level >= 550) cout << _unsegmented << "[" << i << "] : propto p(yes) = " << yes << ", p(no) = " << no << endl;
+  if (debug_level >= 550) cout << "p_cont: " << p_cont << " denom: " << denom << endl;
+  if (debug_level >= 550) cout << get_unsegmented() << "[" << i << "] : propto p(yes) = " << yes << ", p(no) = " << no << endl;
 #endif
   //normalize
   yes = yes / (yes+no); 
   no = 1.0-yes;
 #ifndef NDEBUG
-  if (debug_level >= 500) cout << _unsegmented << "[" << i << "] : norm'zd p(yes) = " << yes << ", p(no) = " << no << endl;
+  if (debug_level >= 500) cout << get_unsegmented() << "[" << i << "] : norm'zd p(yes) = " << yes << ", p(no) = " << no << endl;
 #endif
   //do annealing
-  yes = pow(yes, temp);
-  no = pow(no, temp);
+  yes = anneal<ANNEAL>(yes, temp);
+  no = anneal<ANNEAL>(no, temp);
   //cout << "(" << yes << "," << no << ") ";
   Float p_yes = yes / (yes+no);
   //cout << p_yes << " ";
+  if (timed) Profile::step(Profile::ADD);
   if (randd() < p_yes) {
-    _boundaries[i].yes = true;
-    lexicon.inc(left);
-    lexicon.inc(right);
+    set_boundary(i, true);
+    seat(prev, i, left, lexicon);
+    center = seat(i, next, right, lexicon);
   }
   else {
-    _boundaries[i].yes = false;
-    lexicon.inc(center);
+    set_boundary(i, false);
+    center = seat(prev, next, center, lexicon);
   }
+  if (timed) Profile::end_site();
   //cout << endl;
+  //the word around i+1 ends at next too, unless next is i+1.
+  return next > i+1 ? center : SymbolTable::EDGE;
 }
 
 //samples a single boundary point at position j
 //with temperature temp (bigram model)
+template <bool ANNEAL>
 void
 Utterance::sample_bigram(Count j, State& state, Float temp) {
   debug_output(800, "Utterance::sample_bigram:\n", *this);
   Lexicon& lexicon = state.get_lexicon();   
   BiLexicon& bilex = state.get_bilexicon();
   //indices are l,i,j,k,n in order from l to r.
-  string li,kn;
+  WordId li,kn;
   int i = prev_boundary(j);
   if (i < 0) {
     li = U_EDGE;
@@ -297,27 +485,27 @@ Utterance::sample_bigram(Count j, State& state, Float temp) {
   else {
     li = word_between(prev_boundary(i),i);
   }
-  string ij = word_between(i,j);
+  //the words that may be new are added to the table, since the
+  //bigram model's probs are looked up by id.
+  WordId ij = intern_between(i,j);
   Count k = next_boundary(j);
-  string jk = word_between(j,k);
-  string ik = word_between(i,k);
-  Count n_table;
+  WordId jk = intern_between(j,k);
+  WordId ik = intern_between(i,k);
   int n = -1;
-  if (k == _boundaries.size()-1) {
+  if (k == _length-1) {
     kn = U_EDGE;
-    n_table = _boundaries[k].final_table;
   }
   else{
     n = next_boundary(k);
     kn = word_between(k,n);
-    n_table =_boundaries[n].table;
   }
   Bigram lij(li,ij);
   Bigram ijk(ij,jk);
   Bigram jkn(jk,kn);
   Bigram lik(li,ik);
   Bigram ikn(ik,kn);
-  if (_boundaries[j].yes) {
+  bool timed = Profile::start_site();
+  if (boundary(j)) {
     //we don't dec li: cancels with "no" case in first
     // factor (and if U_EDGE, is annoying b/c not in lex).
     // will need to change this if doing MH.
@@ -327,6 +515,7 @@ Utterance::sample_bigram(Count j, State& state, Float temp) {
     // see above.
     subtract_counts(lexicon, bilex,j,k,n,ik,lik,ikn);
   }
+  if (timed) Profile::step(Profile::PREDICTIVE);
   Float yes;
   Float no;
   yes = compute_predictive(lij, state) *
@@ -335,27 +524,29 @@ Utterance::sample_bigram(Count j, State& state, Float temp) {
   no = compute_predictive(lik, state) * 
     compute_predictive(ikn, state);
 #ifndef NDEBUG
-  if (debug_level >= 550) cout << ij << " " << lexicon(ij) << ", " << jk << " " << lexicon(jk) << ", " << ik << " " << lexicon(ik) << " " << state.alpha1() << endl;
-   if (debug_level >= 550) cout << _unsegmented << "[" << j << "] : propto p(yes) = " << yes << ", p(no) = " << no << endl;
+  if (debug_level >= 550) cout << SymbolTable::WORDS.str(ij) << " " << lexicon(ij) << ", " << SymbolTable::WORDS.str(jk) << " " << lexicon(jk) << ", " << SymbolTable::WORDS.str(ik) << " " << lexicon(ik) << " " << state.alpha1() << endl;
+   if (debug_level >= 550) cout << get_unsegmented() << "[" << j << "] : propto p(yes) = " << yes << ", p(no) = " << no << endl;
 #endif
   //normalize
   yes = yes / (yes+no); 
   no = 1.0-yes;
 #ifndef NDEBUG
   if (debug_level >= 500)
-    cout << _unsegmented << "[" << j << "] : norm'zd p(yes) = " << yes << ", p(no) = " << no << endl;
+    cout << get_unsegmented() << "[" << j << "] : norm'zd p(yes) = " << yes << ", p(no) = " << no << endl;
 #endif
   //do annealing
-  yes = pow(yes, temp);
-  no = pow(no, temp);
+  yes = anneal<ANNEAL>(yes, temp);
+  no = anneal<ANNEAL>(no, temp);
   Float p_yes = yes / (yes+no);
   // now choose table assignments
+  if (timed) Profile::step(Profile::ADD);
   if (randd() < p_yes) {  //we will end up with a boundary
     add_boundary(lexicon, bilex,j,k,n,ij,jk,lij,ijk,jkn,temp);
   }
   else {
     add_no_boundary(lexicon, bilex,j,k,n,ik,lik,ikn,temp);
   }
+  if (timed) Profile::end_site();
 }
 
 // subtracts unigram and bigram counts when there is
@@ -363,24 +554,15 @@ Utterance::sample_bigram(Count j, State& state, Float temp) {
 void
 Utterance::subtract_counts(Lexicon& lexicon, BiLexicon& bilex,
 			   Count j, Count k, int n, 
-			   const string& ij, const string& jk,
+			   WordId ij, WordId jk,
 			   const Bigram& lij, const Bigram& ijk, const Bigram& jkn) {
   debug_output(800, "Utterance::subtract_count(yes): j=", j);
-  _boundaries[j].yes = false;
+  set_boundary(j, false);
   lexicon.dec(ij);
   lexicon.dec(jk);
-  bilex.remove(lij, _boundaries[j].table);
-  _boundaries[j].table = 0;
-  bilex.remove(ijk, _boundaries[k].table);
-  _boundaries[k].table = 0;
-  if (n < 0) {
-    bilex.remove(jkn, _boundaries[k].final_table);
-    _boundaries[k].final_table = 0;
-  }
-  else {
-    bilex.remove(jkn, _boundaries[n].table);
-    _boundaries[n].table = 0;
-  }
+  bilex.dec(lij);
+  bilex.dec(ijk);
+  bilex.dec(jkn);
 }
 
 // subtracts unigram and bigram counts when there is
@@ -388,20 +570,12 @@ Utterance::subtract_counts(Lexicon& lexicon, BiLexicon& bilex,
 void
 Utterance::subtract_counts(Lexicon& lexicon, BiLexicon& bilex,
 			Count j, Count k, int n, 
-			const string& ik,
+			WordId ik,
 			const Bigram& lik, const Bigram& ikn) {
   debug_output(800, "Utterance::subtract_counts(no): j=", j);
   lexicon.dec(ik);
-  bilex.remove(lik, _boundaries[k].table);
-  _boundaries[k].table = 0;
-  if (n < 0) {
-    bilex.remove(ikn, _boundaries[k].final_table);
-    _boundaries[k].final_table = 0;
-  }
-  else {
-    bilex.remove(ikn, _boundaries[n].table);
-    _boundaries[n].table = 0;
-  }
+  bilex.dec(lik);
+  bilex.dec(ikn);
 }
 
 
@@ -411,19 +585,13 @@ Utterance::subtract_counts(Lexicon& lexicon, BiLexicon& bilex,
 void
 Utterance::add_no_boundary(Lexicon& lexicon, BiLexicon& bilex,
 			   Count j, Count k, int n, 
-			   const string& ik,
+			   WordId ik,
 			   const Bigram& lik, const Bigram& ikn, Float temp) {
   debug_output(800, "Utterance::remove_boundary(): j=", j);
-  _boundaries[j].yes = false;
+  set_boundary(j, false);
   lexicon.inc(ik);
-  _boundaries[j].table = 0;
-  _boundaries[k].table = bilex.inc(lik, temp);
-  if (n < 0) {
-    _boundaries[k].final_table = bilex.inc(ikn, temp);
-  }
-  else {
-    _boundaries[n].table = bilex.inc(ikn, temp);
-  }
+  bilex.inc(lik, temp);
+  bilex.inc(ikn, temp);
 }
 
 // adds a boundary at position j and
@@ -432,21 +600,16 @@ Utterance::add_no_boundary(Lexicon& lexicon, BiLexicon& bilex,
 void
 Utterance::add_boundary(Lexicon& lexicon, BiLexicon& bilex,
 			Count j, Count k, int n, 
-			const string& ij, const string& jk,
+			WordId ij, WordId jk,
 			const Bigram& lij, const Bigram& ijk, const Bigram& jkn, 
 			Float temp) {
   debug_output(800, "Utterance::add_boundary(): j=", j);
-  _boundaries[j].yes = true;
+  set_boundary(j, true);
   lexicon.inc(ij);
   lexicon.inc(jk);
-  _boundaries[j].table = bilex.inc(lij, temp);
-  _boundaries[k].table = bilex.inc(ijk, temp);
-  if (n < 0) {
-    _boundaries[k].final_table = bilex.inc(jkn, temp);
-  }
-  else {
-    _boundaries[n].table = bilex.inc(jkn, temp);
-  }
+  bilex.inc(lij, temp);
+  bilex.inc(ijk, temp);
+  bilex.inc(jkn, temp);
 }
 
 //resample tables for boundary=yes case.
@@ -455,18 +618,12 @@ Utterance::sample_tables(BiLexicon& bilex, Count j, Count k, int n,
 			 const Bigram& lij, const Bigram& ijk, 
 			 const Bigram& jkn, Float temp) {
   debug_output(800, "Utterance::sample_tables(yes): j=", j);
-  bilex.remove(lij, _boundaries[j].table);
-  _boundaries[j].table = bilex.inc(lij, temp);
-  bilex.remove(ijk, _boundaries[k].table);
-  _boundaries[k].table = bilex.inc(ijk, temp);
-  if (n < 0) {
-    bilex.remove(jkn, _boundaries[k].final_table);
-    _boundaries[k].final_table = bilex.inc(jkn, temp);
-  }
-  else {
-    bilex.remove(jkn, _boundaries[n].table);
-    _boundaries[n].table = bilex.inc(jkn, temp);
-  }
+  bilex.dec(lij);
+  bilex.inc(lij, temp);
+  bilex.dec(ijk);
+  bilex.inc(ijk, temp);
+  bilex.dec(jkn);
+  bilex.inc(jkn, temp);
 }
 
 // resample tables for boundary = no case.
@@ -474,58 +631,66 @@ void
 Utterance::sample_tables(BiLexicon& bilex, Count k, int n, 
 			 const Bigram& lik, const Bigram& ikn, Float temp) {
   debug_output(800, "Utterance::sample_tables(no)", "");
-  bilex.remove(lik, _boundaries[k].table);
-  _boundaries[k].table = bilex.inc(lik, temp);
-  if (n < 0) {
-    bilex.remove(ikn, _boundaries[k].final_table);
-    _boundaries[k].final_table = bilex.inc(ikn, temp);
-  }
-  else {
-    bilex.remove(ikn, _boundaries[n].table);
-    _boundaries[n].table = bilex.inc(ikn, temp);
-  }
-}
-
-void
-Utterance::sample_table(const BiLexicon& bilex, Count index,
-			const Bigram& bg, Float temp, bool final) {
-  /*
-  // implementing bilex.sample_table is nontrivial
-  Float old_table;
-  if (final) {
-    old_table = _boundaries[index].final_table;
-  }
-  else {
-    old_table = _boundaries[index].table;
-  }
-  Float new_table = bilex.sample_table(bg, old_table, temp);
-  if (old_table != new_table) {
-    bilex.remove(bg, old_table);
-    bilex.place(bg, new_table);
-    if (final) {
-      _boundaries[index].final_table = new_table;
-    } 
-    else {
-      _boundaries[j].table = new_table;
-    }
-  }
-  */
+  bilex.dec(lik);
+  bilex.inc(lik, temp);
+  bilex.dec(ikn);
+  bilex.inc(ikn, temp);
 }
 
 //basic numerator for sampling: 
 //Count(wd) + alpha*p(wd)
+template <class Lex>
 Float
-Utterance::numer_base(const string& wd, State& state) {
+Utterance::numer_base(int prev, Count next, WordId wd,
+		      const Lex& lexicon) const {
   /* //for unique lexicon
-  Count n = (state.get_lexicon())(wd);
+  Count n = lexicon(wd);
   if (n>0)
     return n;
   return state.p_word(wd);
   */
   //below is for non-unique lexicon
+  Float p0 = p_word(prev, next, wd, lexicon);
   typedef pair<string, CF> SCF;
-  debug_output(550, "numer_base(): (wd, (count, p0(wd))) = ", SCF(wd, CF((state.get_lexicon())(wd), state.p_word(wd))));
-  return (state.get_lexicon())(wd) + state.p_word(wd);
+  debug_output(550, "numer_base(): (wd, (count, p0(wd))) = ", SCF(SymbolTable::WORDS.str(wd), CF(lexicon(wd), p0)));
+  return lexicon(wd) + p0;
+}
+
+//the generator prob of a span is a difference of prefix sums
+//plus a length term, so this is O(1) even on a cache miss.
+Float
+Utterance::p_word(int prev, Count next) const {
+  return State::p_word(word_between(prev, next),
+		       _log_phones[next+1] - _log_phones[prev+1],
+		       next - prev);
+}
+
+Float
+Utterance::p_word(int prev, Count next, WordId wd,
+		  const Lexicon& lexicon) const {
+  return State::p_word(wd, _log_phones[next+1] - _log_phones[prev+1],
+		       next - prev);
+}
+
+Float
+Utterance::p_word(int prev, Count next, WordId wd,
+		  const LocalLexicon& lexicon) const {
+  return State::p_word(wd, _log_phones[next+1] - _log_phones[prev+1],
+		       next - prev, lexicon);
+}
+
+WordId
+Utterance::word_between(int prev, Count next,
+			const LocalLexicon& lexicon) const {
+  my_assert((prev < (int)next) && (next < _length), next);
+  return lexicon.find(_unsegmented + prev + 1, next - prev);
+}
+
+WordId
+Utterance::intern_between(int prev, Count next,
+			  LocalLexicon& lexicon) const {
+  my_assert((prev < (int)next) && (next < _length), next);
+  return lexicon.intern(_unsegmented + prev + 1, next - prev);
 }
 
 //predictive distribution for words in bigram model.
@@ -581,7 +746,7 @@ Utterance::joint_predictive_dist(const Bigram& bg, Count prev_count,
 				 const BiLexicon& bilex, int table) const {
   typedef pair<Bigram, Count> BiC;
   typedef pair<BiC, Float> BiCF;
-  Count table_count = bilex.ntokens(bg, table);
+  Count table_count = table; //tokens at bg's table so far
   Float numer;
   if (table_count == 0) {
     numer = State::p_word(bg, bilex);
@@ -596,24 +761,39 @@ Utterance::joint_predictive_dist(const Bigram& bg, Count prev_count,
 }
 
 //returns the location of the boundary to left of pos. i (or -1 if none)
+//scans a word at a time, taking the highest set bit below i.
 int
 Utterance::prev_boundary(Count i) const {
-  my_assert((i>=0) && (i<_unsegmented.size()), i);
-  for (int j=i-1; j>=0; j--) {
-    if (_boundaries[j].yes) return j;
-  }
-  return -1;
+  my_assert((i>=0) && (i<_length), i);
+  int w = i >> 6;
+  uint64_t bits = _boundaries[w] & (((uint64_t)1 << (i & 63)) - 1);
+  while (!bits) {
+    if (--w < 0) return -1;
+    bits = _boundaries[w];
+  }
+  return (w << 6) + 63 - __builtin_clzll(bits);
 }
 
 //returns the location of the boundary to right of pos. i
-//i must be between 0 and _boundaries.size()-2 inclusive
-//(i.e. don't call on final boundary at index _boundaries.size()-1.)
+//i must be between 0 and _length-2 inclusive
+//(i.e. don't call on final boundary at index _length-1.)
+//scans a word at a time, taking the lowest set bit above i.
 Count
 Utterance::next_boundary(Count i) const {
-  my_assert((i>=0) && (i<_unsegmented.size()-1), i);
-  for (Count j=i+1; j<_boundaries.size(); j++) {
-    if (_boundaries[j].yes) return j;
-  }
-  assert(0); //should  have found one by now
-  return 0;
+  my_assert((i>=0) && (i<_length-1), i);
+  Count j = i+1;
+  Count w = j >> 6;
+  uint64_t bits = _boundaries[w] & (~(uint64_t)0 << (j & 63));
+  while (!bits) {
+    //the final position is always a boundary, so we find one.
+    my_assert(w+1 < nblocks(), get_unsegmented());
+    bits = _boundaries[++w];
+  }
+  return (w << 6) + __builtin_ctzll(bits);
 }
+
+// the kernels State's sweeps are built from.
+template void Utterance::sample<1, false>(State& state, Float temp);
+template void Utterance::sample<1, true>(State& state, Float temp);
+template void Utterance::sample<2, false>(State& state, Float temp);
+template void Utterance::sample<2, true>(State& state, Float temp);
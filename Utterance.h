@@ -4,26 +4,36 @@
 //#include <iostream.h>
 #include <string>
 #include <vector>
-#include <list>
 #include "utils.h"
 #include "typedefs.h"
 
 /*
-Utterance class represents a single utterance, initially
-containing a _reference transcription (correct segmentation)
-and _unsegmented transcription as strings.  _boundaries
+Utterance class represents a single utterance: its
+_unsegmented characters, the _reference (correct) segmentation
+and the current one.  An Utterance is a view of one utterance
+of a Corpus, which owns the arrays its pointers point into (see
+Corpus.h), so copying one is cheap.  _boundaries
 represents the location of word boundaries in the segmented
-string (initially random, then resampled), with value "true"
+string (initially random, then resampled), with bit i set
 indicating a boundary AFTER the i'th character.  so there is
-a "true" at the final position, but possibly not at i=0.
-_reference uses SENTINEL character as a word separator.
+a boundary at the final position, but possibly not at i=0.
+The bits are packed 64 to a word, so the nearest boundary on
+either side of a position is found with one or two bit scans.
+In the bigram model, the tokens do not remember their tables:
+BiLexicon only knows how many tables of each size each bigram has,
+and removing a token takes it from the table of a random token.
+_reference holds the true boundaries in the same way.
 
-get_reference_words() and get_segmented_words() return the same 
-information as lists of strings.  _reference_words is stored, but
-segmented words change often, so we don't store them.  (These are
-now only used for ease in scoring).
+get_reference() and get_segmented() return the segmentations as
+strings, with SENTINEL as a word separator, and
+get_reference_words() and get_segmented_words() as lists of
+words.  These are built when asked for, and are only used for
+scoring and output.
 
-_score is the score generated by the segmenting algorithm.
+The sampler itself never builds strings: word_between() looks
+the word between two boundaries up in SymbolTable::WORDS by its
+characters, and it is NONE if it has never been seated.  Words
+are interned only when they are seated (see seat()).
 */
 
 using namespace std;
@@ -34,15 +44,13 @@ extern Count debug_level;
 // must be a character not contained in any word
 const char SENTINEL = '|';
 // indicates edge of utt
-const string U_EDGE = "$$";
+const WordId U_EDGE = SymbolTable::EDGE;
 
 class Utterance;
-typedef list<Utterance> Utterances;
+typedef vector<Utterance> Utterances;
 
 class Utterance {
 public:
-  // maximum number of characters per utterance
-  static const int MAX_LENGTH = 500;
   //  typedef std::vector<string> Words;
   class Words: public std::vector<string> {
   public:
@@ -52,29 +60,62 @@ public:
   };
   typedef Words::const_iterator Words_iterator;
   
-  Utterance(const string& reference, Float p_segment=.2);
   //type of initialization for boundaries: "ran", "pho", or "utt".
   static void set_init(string b_init); 
+  //set the initial boundaries, as given by set_init().  p_segment
+  //is the prob of a boundary in a random segmentation.
+  void init_boundaries(Float p_segment=.2);
+  //precompute prefix sums of log phoneme probs, indexed by char.
+  void init_log_phones(const Fs& log_phoneme_ps);
   void add_counts_to_lex(Lexicon& word_counts, BiLexicon& bg_counts, Count model = 1);
-  string get_reference() const {return _reference;}
-  string get_unsegmented() const {return _unsegmented;}
-  string get_segmented() const;
-  double get_score() const {
-    if (_score < 0)
-      cerr << "Warning: Accessing uninitialized score\n";
-    return _score;}
-  const Words& get_reference_words() const {return _reference_words;}
-  Words get_segmented_words();
-  void set_score(double score) {_score = score;}
-  //do Gibbs sampler with annealing temperature, and ngram model
-  void sample(State& state, Float temp=1, Count model=1); 
+  string get_reference() const {return segmentation(_reference);}
+  string get_unsegmented() const {return string(_unsegmented, _length);}
+  string get_segmented() const {return segmentation(_boundaries);}
+  Words get_reference_words() const {return words(_reference);}
+  Words get_segmented_words() const {return words(_boundaries);}
+  //number of characters
+  Count length() const {return _length;}
+  //is there a boundary after the i'th char (now, or in the reference)?
+  bool boundary(Count i) const {
+    return (_boundaries[i >> 6] >> (i & 63)) & 1;
+  }
+  bool reference_boundary(Count i) const {
+    return (_reference[i >> 6] >> (i & 63)) & 1;
+  }
+  //do Gibbs sampler with annealing temperature, under the ngram
+  //model NGRAM (1 or 2).  ANNEAL may be false only if temp is 1,
+  //which saves raising the probabilities to the power temp.  both
+  //are fixed at compile time, so nothing is decided per boundary.
+  template <int NGRAM, bool ANNEAL> void sample(State& state, Float temp=1);
+  //as above, with the model and temperature tested at run time.
+  void sample(State& state, Float temp=1, Count model=1) {
+    if (model == 2)
+      temp == 1 ? sample<2, false>(state, temp) : sample<2, true>(state, temp);
+    else
+      temp == 1 ? sample<1, false>(state, temp) : sample<1, true>(state, temp);
+  }
+  //as above (unigram model), for a worker thread of a parallel
+  //sweep, which counts words in its own view of the lexicon.
+  void sample(LocalLexicon& lexicon, const State& state, Float temp=1);
+  //resample the whole segmentation at once (unigram model only),
+  //with words of at most max_length chars (0 for no limit).
+  void sample_block(State& state, Float temp=1, Count max_length=0);
   //for unigram model (nutts is the # utts before this one.)
   Float log_posterior (Count nutts, Lexicon& lex, const State& state) const;
   //for bigram model
   Float log_posterior (Count nutts, Lexicon& lex, BiLexicon& bilex, const State& state) const;
-  void print_reference(ostream& os=cout) const {os << _reference << '\n';}
+  void print_reference(ostream& os=cout) const {os << get_reference() << '\n';}
   void print_segmented(ostream& os=cout) const {os << get_segmented() << '\n';}
-  void print_unsegmented(ostream& os=cout) const {os << _unsegmented << '\n';}
+  void print_unsegmented(ostream& os=cout) const {os << get_unsegmented() << '\n';}
+  //number of words in the current segmentation
+  Count nwords() const {
+    Count n = 0;
+    for (Count k = 0; k < nblocks(); k++)
+      n += __builtin_popcountll(_boundaries[k]);
+    return n;
+  }
+  friend class TypeSampler;
+  friend class Corpus;
   friend ostream& operator<< (ostream& os, const Utterance& u) {
 #ifdef NDEBUG
     return u.print_basic(os);
@@ -83,6 +124,16 @@ public:
 #endif
   }
 private:
+  Utterance(const char* unsegmented, Count length, uint64_t* boundaries,
+	    const uint64_t* reference, Float* log_phones)
+    :_unsegmented(unsegmented), _length(length), _boundaries(boundaries),
+     _reference(reference), _log_phones(log_phones) {}
+  //the utterance with SENTINEL after each word ending at bits.
+  string segmentation(const uint64_t* bits) const;
+  //the words ending at bits.
+  Words words(const uint64_t* bits) const;
+  //number of 64-bit words of boundaries
+  Count nblocks() const {return (_length+63)/64;}
   ostream& print_basic(ostream& os) const {
       string utt = get_segmented();
       for (Count i=0; i<utt.size()-1; i++) {
@@ -95,39 +146,41 @@ private:
   }
   ostream& print_debug(ostream& os) const {
     if (debug_level > 800) {
-    os << _unsegmented << endl;
-    for (Count i=0; i<_boundaries.size(); i++) os << _boundaries[i].yes;
-    os << endl;
-    for (Count i=0; i<_boundaries.size(); i++) os << _boundaries[i].table;
-    os << endl;
-    for (Count i=0; i<_boundaries.size(); i++) os << _boundaries[i].final_table;
+    os << get_unsegmented() << endl;
+    for (Count i=0; i<_length; i++) os << boundary(i);
     os << endl;
     return os;
     }
     return print_basic(os);
   }
-  //sample one boundary at pos'n i w/ temperature temp
-  void sample_one(Count i, State& state, Float temp = 1); 
+  //sample one boundary at pos'n i w/ temperature temp,
+  //counting words in lexicon (a Lexicon or LocalLexicon).
+  //center is the word around i, from the boundary before it to
+  //the one after, if the caller knows it, and EDGE (which is no
+  //word) if not.  returns the word around i+1 if it is known by
+  //then, and EDGE if not, so a sweep looks up two words a site.
+  template <bool ANNEAL, class Lex>
+  WordId sample_one(Count i, WordId center, Lex& lexicon,
+		    const State& state, Float temp = 1);
   //sample one boundary in bigram model
+  template <bool ANNEAL>
   void sample_bigram(Count i, State& state, Float temp = 1); 
-  void sample_table(const BiLexicon& bilex, Count index,
-		    const Bigram& bg, Float temp = 1, bool final = false);
   void subtract_counts(Lexicon& lexicon, BiLexicon& bilex,
 		    Count j, Count k, int n, 
-		    const string& ik,
+		    WordId ik,
 		    const Bigram& lik, const Bigram& jkn);
   void subtract_counts(Lexicon& lexicon, BiLexicon& bilex,
 		    Count j, Count k, int n, 
-		    const string& ij, const string& jk,
+		    WordId ij, WordId jk,
 		    const Bigram& lij, const Bigram& ijk, 
 		    const Bigram& jkn);
   void add_no_boundary(Lexicon& lexicon, BiLexicon& bilex,
 		    Count j, Count k, int n, 
-		    const string& ik,
+		    WordId ik,
 		    const Bigram& lik, const Bigram& jkn, Float temp = 1);
   void add_boundary(Lexicon& lexicon, BiLexicon& bilex,
 		    Count j, Count k, int n, 
-		    const string& ij, const string& jk,
+		    WordId ij, WordId jk,
 		    const Bigram& lij, const Bigram& ijk, 
 		    const Bigram& jkn, Float temp = 1);
   void sample_tables(BiLexicon& bilex, Count j, Count k, int n, 
@@ -135,9 +188,41 @@ private:
 		     const Bigram& jkn, Float temp);
   void sample_tables(BiLexicon& bilex, Count k, int n, 
 		     const Bigram& lik, const Bigram& jkn, Float temp);
-  inline Float numer_base(const string& wd, State& state);
-  //When table >= 0, we subtract counts from that table when
-  //computing predictive dist.
+  //count of wd (the word between prev and next) plus its prior
+  //prob.
+  template <class Lex>
+  inline Float numer_base(int prev, Count next, WordId wd,
+			  const Lex& lexicon) const;
+  //weight of the word made of chars i..j-1 in the blocked
+  //sampler's proposal.  (the final word gets p_cont too: it is
+  //the same for all segmentations.)
+  inline Float block_weight(Count i, Count j, WordId w,
+			    const Lexicon& lexicon,
+			    Float denom, Float p_cont) const;
+  //the ids of the words of at most max_len chars starting at
+  //each char i, in ids[at[i] .. at[i+1]).  each run stops at the
+  //first word not in the table, as no longer one is either.
+  void words_from(Count max_len, Cs& at, vector<WordId>& ids) const;
+  //the word of chars i..j-1, from words_from().
+  static WordId word_from(Count i, Count j, const Cs& at,
+			  const vector<WordId>& ids) {
+    Count k = at[i] + (j-1-i);
+    return k < at[i+1] ? ids[k] : SymbolTable::NONE;
+  }
+  //log prob of the words ending at ends under the sequential
+  //predictive distribution, which counts each word as it goes.
+  Float log_sequential(const Cs& ends, Lexicon& lexicon,
+		       Count nutts) const;
+  //prior prob of the word between prev. and next boundaries
+  Float p_word(int prev, Count next) const;
+  //the same, for the word wd between them as counted in lexicon
+  //(see word_between()).  worker threads must not write State's
+  //cache, so misses are left in their LocalLexicon.
+  Float p_word(int prev, Count next, WordId wd, const Lexicon& lexicon) const;
+  Float p_word(int prev, Count next, WordId wd,
+	       const LocalLexicon& lexicon) const;
+  //When table >= 0, bg is at a table with that many tokens, and
+  //we subtract its count when computing predictive dist.
   Float compute_predictive(const Bigram& bg, State& state, 
 		   int table = -1, Count denom_sub = 0) const;
   Float predictive_dist(const Bigram& bg, Count prev_count,
@@ -146,34 +231,84 @@ private:
   // used in log posterior computation
   Float joint_predictive_dist(const Bigram& bg, Count prev_count,
 			      const BiLexicon& bilex, int table) const;
-  //return the string from prev boundary to i.
-  string left_word(Count i) const {
-    my_assert((i>=0) && (i<_unsegmented.length()), i);
-    int prev = prev_boundary(i);
-    return _unsegmented.substr(prev+1, i-prev);}
-  //return the string from i to next boundary.
-  string right_word(Count i) const {
-    my_assert((i>=0) && (i<_unsegmented.length()-1), i);
-    Count next = next_boundary(i);
-    return _unsegmented.substr(i+1, next-i);}
-  //return the string around i from prev boundary to next boundary.
-  string center_word(Count i) const {
-    my_assert((i>=0) && (i<_unsegmented.length()-1), i);
+  //return the word from prev boundary to i.
+  WordId left_word(Count i) const {
+    my_assert((i>=0) && (i<_length), i);
+    return word_between(prev_boundary(i), i);}
+  //return the word from i to next boundary.
+  WordId right_word(Count i) const {
+    my_assert((i>=0) && (i<_length-1), i);
+    return word_between(i, next_boundary(i));}
+  //return the word around i from prev boundary to next boundary.
+  WordId center_word(Count i) const {
+    my_assert((i>=0) && (i<_length-1), i);
     return word_between(prev_boundary(i), next_boundary(i));
   }
   // returns word between prev. and next boundaries
-  string word_between(int prev, Count next) const {
-    return _unsegmented.substr(prev+1, next-prev);
+  // (i.e. the characters prev+1 .. next inclusive), or
+  // SymbolTable::NONE if it is not in the table.
+  WordId word_between(int prev, Count next) const {
+    my_assert((prev < (int)next) && (next < _length), next);
+    return SymbolTable::WORDS.find(_unsegmented + prev + 1, next - prev);
+  }
+  // the same, for a word counted in lexicon.  a worker's
+  // LocalLexicon has ids of its own for the words it has added.
+  WordId word_between(int prev, Count next, const Lexicon& lexicon) const {
+    return word_between(prev, next);
+  }
+  WordId word_between(int prev, Count next, const LocalLexicon& lexicon) const;
+  // word_between(prev, next, lexicon) given left, the word
+  // between prev and i: a word whose prefix is not in the table
+  // is not either.
+  template <class Lex>
+  WordId word_between(int prev, Count i, Count next, WordId left,
+		      const Lex& lexicon) const {
+    if (left == SymbolTable::NONE) return left;
+    return word_between(prev, next, lexicon);
+  }
+  // as word_between(), but adds the word if it is not there.
+  WordId intern_between(int prev, Count next) const {
+    my_assert((prev < (int)next) && (next < _length), next);
+    return SymbolTable::WORDS.intern(_unsegmented + prev + 1, next - prev);
+  }
+  WordId intern_between(int prev, Count next, Lexicon& lexicon) const {
+    return intern_between(prev, next);
+  }
+  WordId intern_between(int prev, Count next, LocalLexicon& lexicon) const;
+  // adds the word between prev and next to lexicon, and returns
+  // its id.  w is the id word_between() gave, which is NONE if the
+  // word is new.
+  template <class Lex>
+  WordId seat(int prev, Count next, WordId w, Lex& lexicon) const {
+    if (w == SymbolTable::NONE)
+      w = intern_between(prev, next, lexicon);
+    lexicon.inc(w);
+    return w;
+  }
+  // kdelta() of left and right, the words between prev and i and
+  // between i and next.  two new words are told apart by their
+  // chars.
+  Count same_words(WordId left, WordId right,
+		   int prev, Count i, Count next) const {
+    if (left != SymbolTable::NONE || right != SymbolTable::NONE)
+      return left == right;
+    return i - prev == next - i &&
+      !memcmp(_unsegmented + prev + 1, _unsegmented + i + 1, i - prev);
+  }
+  void set_boundary(Count i, bool yes) {
+    if (yes)
+      _boundaries[i >> 6] |= (uint64_t)1 << (i & 63);
+    else
+      _boundaries[i >> 6] &= ~((uint64_t)1 << (i & 63));
   }
   //returns -1 if prev. boundary is beg. of utt.
   int prev_boundary(Count i) const;
   Count next_boundary(Count i) const;
-  string _reference;
-  string _unsegmented;
-  typedef vector<Boundary> Boundaries;
-  Boundaries _boundaries; //is there a boundary after the i'th char?
-  double _score;
-  Words _reference_words;
+  const char* _unsegmented; // not NUL-terminated
+  Count _length;
+  uint64_t* _boundaries; //is there a boundary after the i'th char?
+  const uint64_t* _reference; //the same, in the true segmentation
+  Float* _log_phones; // sum of log phoneme probs of chars before i
   static int _init;
   static const int TRUE_INIT = 3;
   static const int UTT_INIT = 2;
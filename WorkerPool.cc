@@ -0,0 +1,59 @@
+#include "WorkerPool.h"
+
+void
+WorkerPool::run(Count nthreads, const Job& job) {
+  if (nthreads != this->nthreads())
+    start(nthreads);
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _job = &job;
+    _running = _threads.size();
+    _round++;
+    _started.notify_all();
+  }
+  job(0);
+  std::unique_lock<std::mutex> lock(_mutex);
+  while (_running)
+    _finished.wait(lock);
+  _job = NULL;
+}
+
+void
+WorkerPool::start(Count nthreads) {
+  stop();
+  _done = false;
+  // a new worker waits for the round after this one, even if it
+  // only gets going after run() has started that round.
+  for (Count t = 1; t < nthreads; t++)
+    _threads.push_back(std::thread(&WorkerPool::work, this, t, _round));
+}
+
+void
+WorkerPool::stop() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _done = true;
+    _started.notify_all();
+  }
+  for (Count t = 0; t < _threads.size(); t++)
+    _threads[t].join();
+  _threads.clear();
+}
+
+void
+WorkerPool::work(Count t, Count round) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  for (;;) {
+    while (_round == round && !_done)
+      _started.wait(lock);
+    if (_done)
+      break;
+    round = _round;
+    const Job* job = _job;
+    lock.unlock();
+    (*job)(t);
+    lock.lock();
+    if (--_running == 0)
+      _finished.notify_one();
+  }
+}
@@ -0,0 +1,46 @@
+#ifndef _WORKERPOOL_H_
+#define _WORKERPOOL_H_
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "typedefs.h"
+
+/*
+WorkerPool keeps threads waiting between rounds of work, so that a
+parallel sweep can sync many times without starting and joining a
+thread each time.  run() hands a job to the workers and does its
+own share on the calling thread, then waits for the others: each
+call is a barrier.  The workers are started by the first run() (or
+when the number of threads changes) and stopped by the destructor.
+*/
+
+class WorkerPool {
+public:
+  typedef std::function<void(Count)> Job;
+  WorkerPool(): _job(NULL), _round(0), _running(0), _done(false) {}
+  ~WorkerPool() {stop();}
+  // calls job(t) for t = 0 .. nthreads-1, job(0) on this thread and
+  // the others on the workers, and returns when all have returned.
+  void run(Count nthreads, const Job& job);
+  Count nthreads() const {return _threads.size() + 1;}
+private:
+  std::vector<std::thread> _threads;
+  const Job* _job; // the current round's job
+  Count _round; // rounds started
+  Count _running; // workers yet to finish this round
+  bool _done;
+  std::mutex _mutex;
+  std::condition_variable _started;
+  std::condition_variable _finished;
+  void start(Count nthreads);
+  void stop();
+  // the body of worker t, which has seen the rounds up to round.
+  void work(Count t, Count round);
+  WorkerPool(const WorkerPool&);
+  void operator=(const WorkerPool&);
+};
+
+#endif
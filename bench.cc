@@ -0,0 +1,438 @@
+// bench.cc
+//
+// Benchmarks, printed as one line of JSON per result (with at
+// least "bench" and, for timings, "ns_per_op").
+//
+//  - draws from an Urn, with and without the alias table, and the
+//    heap allocations made while drawing (there should be none
+//    once the urn has grown); Rng against rand(); and the heap
+//    memory per bigram of the bigram table.
+//  - the sampler's kernels, on a synthetic corpus: a boundary
+//    sampled under the unigram (Utterance::sample_one) and bigram
+//    (Utterance::sample_bigram) models, and the same with the
+//    kernel specialized for temperature 1 against the general one
+//    ("speedup"), Restaurant::sample_table,
+//    BiLexicon::place and remove, State::p_word, State::log_posterior
+//    and Scoring::score_utterance.
+//  - whole sweeps over synthetic corpora of each size given on the
+//    command line (default 10k, 100k and 1M utterances), each in a
+//    child process so that its peak RSS is its own.
+//
+// Build and run it with "make bench" (BENCH_ARGS gives the sizes).
+// Times are CPU times, so run it on an otherwise idle machine.
+//
+#include <iostream>
+#include <sstream>
+#include <new>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <malloc.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+#include "Urn.h"
+#include "FlatMap.h"
+#include "NGrams.h"
+#include "Restaurant.h"
+#include "State.h"
+#include "Scoring.h"
+#include "Generator.h"
+
+Count debug_level = 0;
+Float HYPERSAMPLING_RATIO(.1);
+bool SAMPLE_HYPERPARAMETERS(0);
+
+static size_t nallocs = 0;
+static size_t live_bytes = 0;
+
+//the scalar and array forms are counted alike.  the deletes free
+//through a call gcc does not inline, as in segment.cc.
+static void* counted_new(size_t n) {
+  nallocs++;
+  void* p = malloc(n ? n : 1);
+  if (!p) throw bad_alloc();
+  live_bytes += malloc_usable_size(p);
+  return p;
+}
+__attribute__((noinline)) static void counted_free(void* p) noexcept {
+  if (p) live_bytes -= malloc_usable_size(p);
+  free(p);
+}
+void* operator new(size_t n) { return counted_new(n); }
+void* operator new[](size_t n) { return counted_new(n); }
+void operator delete(void* p) noexcept { counted_free(p); }
+void operator delete[](void* p) noexcept { counted_free(p); }
+void operator delete(void* p, size_t) noexcept { counted_free(p); }
+void operator delete[](void* p, size_t) noexcept { counted_free(p); }
+
+//one result, printed as a line of JSON when it goes out of scope:
+//  Result("name")("key", value)...;
+class Result {
+public:
+  Result(const string& name) {_os << "{\"bench\": \"" << name << "\"";}
+  ~Result() {cout << _os.str() << "}" << endl;}
+  //value is a number.
+  template <typename T> Result& operator()(const string& key, T value) {
+    _os << ", \"" << key << "\": " << value;
+    return *this;
+  }
+  Result& operator()(const string& key, const char* value) {
+    _os << ", \"" << key << "\": \"" << value << "\"";
+    return *this;
+  }
+private:
+  ostringstream _os;
+};
+
+//peak resident set size in MB, from /proc/self/status.
+static double
+peak_rss() {
+  ifstream is("/proc/self/status");
+  string line;
+  while (getline(is, line)) {
+    if (!line.compare(0, 6, "VmHWM:"))
+      return strtod(line.c_str() + 6, NULL) / 1024;
+  }
+  return 0;
+}
+
+typedef Urn<int, double> IntUrn;
+
+static double
+seconds() {
+  return clock() / (double)CLOCKS_PER_SEC;
+}
+
+static void
+fill(IntUrn& urn, int n) {
+  urn.clear();
+  for (int i = 0; i < n; i++)
+    urn.push(i, 1.0 / (i + 1)); //zipfian, like word counts
+}
+
+//draws ndraws times from an urn over n objects, refilling it
+//every refill draws; prints the time per draw and the
+//allocations per draw after the first fill.  a one-shot urn is
+//refilled before every draw.
+static void
+bench(const char* name, int n, long ndraws, long refill, bool alias) {
+  IntUrn& urn = IntUrn::scratch();
+  fill(urn, n);
+  if (alias) urn.build_alias();
+  size_t before = nallocs;
+  long check = 0;
+  double start = seconds();
+  for (long d = 0; d < ndraws; d++) {
+    if (refill && d % refill == 0) {
+      fill(urn, n);
+      if (alias) urn.build_alias();
+    }
+    check += urn.draw();
+  }
+  double secs = seconds() - start;
+  Result(string("urn.") + name)("n", n)("ns_per_op", secs / ndraws * 1e9)
+    ("allocs_per_op", (nallocs - before) / (double)ndraws)
+    ("check", check % 10);
+}
+
+//times n uniforms from rand(), Rng::uniform() and Rng::uniforms().
+static void
+bench_rng(long n) {
+  double sum = 0;
+  double start = seconds();
+  for (long i = 0; i < n; i++)
+    sum += rand() / (RAND_MAX + 1.0);
+  double t_rand = seconds() - start;
+  Rng rng(1);
+  start = seconds();
+  for (long i = 0; i < n; i++)
+    sum += rng.uniform();
+  double t_rng = seconds() - start;
+  double buffer[1024];
+  start = seconds();
+  for (long i = 0; i < n; i += 1024) {
+    rng.uniforms(buffer, 1024);
+    sum += buffer[i % 1024];
+  }
+  double t_bulk = seconds() - start;
+  Result("rng.rand")("ns_per_op", t_rand / n * 1e9);
+  Result("rng.uniform")("ns_per_op", t_rng / n * 1e9);
+  Result("rng.uniforms")("ns_per_op", t_bulk / n * 1e9)("check", sum > 0);
+}
+
+//heap bytes per bigram for n bigrams with one token each, as
+//two node-based maps (count and restaurant, as BiLexicon used to
+//keep them) and as one FlatMap of restaurants.
+static void
+bench_bigrams(WordId n) {
+  size_t before = live_bytes;
+  {
+    unordered_map<Bigram, Count> counts;
+    unordered_map<Bigram, Restaurant> restaurants;
+    for (WordId i = 0; i < n; i++) {
+      Bigram b(i % 1000, i / 1000);
+      counts[b]++;
+      restaurants[b].inc_table(0);
+    }
+    Result("bigrams.unordered_maps")("n", n)
+      ("bytes_per_bigram", (live_bytes - before) / (double)n);
+  }
+  before = live_bytes;
+  {
+    FlatMap<uint64_t, Restaurant> restaurants;
+    for (WordId i = 0; i < n; i++) {
+      Bigram b(i % 1000, i / 1000);
+      restaurants.insert(b.key()).first->second.inc_table(0);
+    }
+    Result("bigrams.flatmap")("n", n)
+      ("bytes_per_bigram", (live_bytes - before) / (double)n);
+  }
+}
+
+//a synthetic corpus of n utterances (see Generator.h), with a
+//lexicon of 5000 words.
+static string
+synthetic_corpus(Count n) {
+  Generator generator(26, 5000, 3.5, 3.5, 1, 1);
+  string text;
+  generator.generate(n, text);
+  return text;
+}
+
+//hands State a corpus held in memory.
+class TextDatafile: public DatafileBase {
+public:
+  TextDatafile(const string& text): _text(text) {}
+  virtual string next_reference() {return string();}
+  virtual void reset() {}
+  virtual size_t load(Corpus& corpus, Count nthreads=1) {
+    corpus.parse(_text.data(), _text.data() + _text.size());
+    return _text.size();
+  }
+  //the number of boundaries that are sampled.
+  Count nsites() const {
+    Count n = 0;
+    for (Count i = 0; i < _text.size(); i++)
+      n += (_text[i] != ' ' && _text[i] != '\n');
+    return n - count(_text.begin(), _text.end(), '\n');
+  }
+private:
+  const string& _text;
+};
+
+//a State for text under the unigram (ngram 1) or bigram model,
+//with its output to cout thrown away.
+static State*
+make_state(TextDatafile& data, int ngram) {
+  ostringstream quiet;
+  streambuf* out = cout.rdbuf(quiet.rdbuf());
+  State::set_models("m", "t", ngram);
+  State::set_sampler("single");
+  State::set_threads(1);
+  State* state = ngram == 1 ? new State(&data, 20, .5, 0, .5) :
+    new State(&data, 3000, .2, 100, .5);
+  cout.rdbuf(out);
+  return state;
+}
+
+//sweeps at temperature 1 with the kernel specialized for it, with
+//the general one (which raises every probability to the power
+//temp), and with the model and temperature tested per utterance,
+//the best of nrounds each.
+template <int NGRAM>
+static void
+bench_specialized(State& state, Count nsites) {
+  const Count nrounds = 5;
+  double specialized = 1e30, general = 1e30, runtime = 1e30;
+  for (Count r = 0; r < nrounds; r++) {
+    double start = seconds();
+    foreach(Utterances, u, state.utterances())
+      u->sample<NGRAM, false>(state, 1);
+    specialized = min(specialized, seconds() - start);
+    start = seconds();
+    foreach(Utterances, u, state.utterances())
+      u->sample<NGRAM, true>(state, 1);
+    general = min(general, seconds() - start);
+    start = seconds();
+    foreach(Utterances, u, state.utterances())
+      u->sample(state, 1, NGRAM);
+    runtime = min(runtime, seconds() - start);
+  }
+  Result("Utterance::sample<NGRAM, ANNEAL>")
+    ("model", NGRAM == 1 ? "unigram" : "bigram")
+    ("ns_per_op", specialized / nsites * 1e9)
+    ("general_ns_per_op", general / nsites * 1e9)
+    ("runtime_ns_per_op", runtime / nsites * 1e9)
+    ("speedup", general / specialized);
+}
+
+//the sampler's kernels, on a synthetic corpus of n utterances.
+static void
+bench_kernels(Count n) {
+  string text = synthetic_corpus(n);
+  TextDatafile data(text);
+  Count nsites = data.nsites();
+  for (int ngram = 1; ngram <= 2; ngram++) {
+    State* state = make_state(data, ngram);
+    state->sample(1); //warm up
+    const Count nsweeps = 3;
+    double start = seconds();
+    for (Count k = 0; k < nsweeps; k++)
+      state->sample(1);
+    double secs = seconds() - start;
+    Result(ngram == 1 ? "Utterance::sample_one" : "Utterance::sample_bigram")
+      ("utterances", n)("ns_per_op", secs / (nsweeps * nsites) * 1e9);
+    if (ngram == 1)
+      bench_specialized<1>(*state, nsites);
+    else
+      bench_specialized<2>(*state, nsites);
+    const Count ncalls = 20;
+    Float check = 0;
+    start = seconds();
+    for (Count k = 0; k < ncalls; k++)
+      check += state->log_posterior();
+    secs = seconds() - start;
+    Result("State::log_posterior")("model", ngram == 1 ? "unigram" : "bigram")
+      ("types", state->get_lexicon().ntypes())
+      ("ns_per_op", secs / ncalls * 1e9)("check", check < 0);
+    if (ngram == 1) {
+      //cached lookups of the words in the lexicon
+      const vector<WordId>& types = state->get_lexicon().types();
+      const Count nlookups = 20000000;
+      check = 0;
+      start = seconds();
+      for (Count k = 0; k < nlookups; k++)
+	check += State::p_word(types[k % types.size()]);
+      secs = seconds() - start;
+      Result("State::p_word")("ns_per_op", secs / nlookups * 1e9)
+	("check", check > 0);
+      Scoring scoring;
+      const Count npasses = 5;
+      start = seconds();
+      for (Count k = 0; k < npasses; k++) {
+	state->score_utterances(scoring);
+	scoring.reset();
+      }
+      secs = seconds() - start;
+      Result("Scoring::score_utterance")
+	("ns_per_op", secs / (npasses * n) * 1e9);
+    }
+    else {
+      //seat tokens of random bigrams over the lexicon's words at
+      //new tables, in a BiLexicon of their own, and unseat them.
+      const vector<WordId>& types = state->get_lexicon().types();
+      BiLexicon bilexicon;
+      vector<Bigram> bigrams;
+      Rng rng(2);
+      for (Count k = 0; k < 100000; k++)
+	bigrams.push_back(Bigram(types[rng.next() % types.size()],
+				 types[rng.next() % types.size()]));
+      const Count nrounds = 20;
+      start = seconds();
+      for (Count r = 0; r < nrounds; r++) {
+	foreach(vector<Bigram>, b, bigrams)
+	  bilexicon.place(*b, 0);
+	foreach(vector<Bigram>, b, bigrams)
+	  bilexicon.remove(*b, 1);
+      }
+      secs = seconds() - start;
+      Result("BiLexicon::place+remove")
+	("ns_per_op", secs / (nrounds * bigrams.size()) * 1e9);
+    }
+    delete state;
+  }
+}
+
+//draws tables from restaurants with tables of one, two, three and
+//many sizes (the last with a dense histogram).
+static void
+bench_restaurants(long ndraws) {
+  const Count nsizes[] = {1, 2, 3, 20};
+  for (int s = 0; s < 4; s++) {
+    Restaurant r;
+    for (Count k = 1; k <= nsizes[s]; k++) {
+      for (Count t = 0; t < 3; t++) {
+	r.inc_table(0);
+	for (Count j = 1; j < k; j++)
+	  r.inc_table(j);
+      }
+    }
+    Count check = 0;
+    double start = seconds();
+    for (long d = 0; d < ndraws; d++)
+      check += r.sample_table(1.5, 1);
+    double secs = seconds() - start;
+    Result("Restaurant::sample_table")("sizes", nsizes[s])
+      ("ns_per_op", secs / ndraws * 1e9)("check", check % 10);
+  }
+}
+
+//whole sweeps over a synthetic corpus of n utterances, under the
+//unigram and bigram models, each in a child process.
+static void
+bench_sweeps(Count n) {
+  for (int ngram = 1; ngram <= 2; ngram++) {
+    cout.flush();
+    pid_t pid = fork();
+    if (pid < 0)
+      error("bench_sweeps(): fork() failed");
+    if (pid > 0) {
+      waitpid(pid, NULL, 0);
+      continue;
+    }
+    //start the peak RSS afresh, not from the parent's.
+    ofstream("/proc/self/clear_refs") << "5" << endl;
+    double start = seconds();
+    string text = synthetic_corpus(n);
+    TextDatafile data(text);
+    State* state = make_state(data, ngram);
+    double load = seconds() - start;
+    //at least one sweep, and at least 5 seconds' worth.
+    Count nsweeps = 0;
+    start = seconds();
+    do {
+      state->sample(1);
+      nsweeps++;
+    } while (seconds() - start < 5);
+    double secs = seconds() - start;
+    Result("sweep")("model", ngram == 1 ? "unigram" : "bigram")
+      ("utterances", n)("boundaries", data.nsites())("load_s", load)
+      ("sweeps", nsweeps)("sweeps_per_s", nsweeps / secs)
+      ("ns_per_boundary", secs / (nsweeps * data.nsites()) * 1e9)
+      ("peak_rss_mb", peak_rss());
+    cout.flush();
+    _exit(0);
+  }
+}
+
+int
+main(int argc, char* argv[]) {
+  Cs corpus_sizes;
+  for (int k = 1; k < argc; k++)
+    corpus_sizes.push_back(strtol(argv[k], NULL, 10));
+  if (corpus_sizes.empty()) {
+    corpus_sizes.push_back(10000);
+    corpus_sizes.push_back(100000);
+    corpus_sizes.push_back(1000000);
+  }
+  //the sweeps go first, while this process is still small.
+  foreach(Cs, n, corpus_sizes)
+    bench_sweeps(*n);
+  bench_kernels(10000);
+  bench_restaurants(10000000);
+  const long ndraws = 10000000;
+  const int sizes[] = {10, 1000, 100000};
+  for (int s = 0; s < 3; s++) {
+    int n = sizes[s];
+    bench("search", n, ndraws, 0, false);
+    bench("alias", n, ndraws, 0, true);
+    bench("one_shot", n, ndraws / n, 1, false);
+  }
+  bench_rng(100000000);
+  bench_bigrams(300000);
+  bench_bigrams(1000000);
+  return 0;
+}
@@ -1,13 +1,20 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <unistd.h>
 #include "ECArgs.h"
 #include "typedefs.h"
 #include "utils.h"
 #include "Utterance.h"
 #include "Scoring.h"
 #include "Datafile.h"
+#include "Corpus.h"
 #include "State.h"
+#include "Checkpoint.h"
+#include "TraceWriter.h"
+#include "Generator.h"
+#include "Profile.h"
+#include "Progress.h"
 
 using namespace std;
 // global variables
@@ -15,12 +22,111 @@ Count debug_level;
 Float HYPERSAMPLING_RATIO(.1); // the standard deviation for new hyperparm proposals
 bool SAMPLE_HYPERPARAMETERS(0);
 
+// every allocation is counted, for --profile.  all the replaceable
+// forms are replaced, so every new is paired with a delete of ours.
+// the deletes free through a call gcc does not inline, or it takes
+// the free() of a pointer from a new-expression for a mismatch.
+static void* counted_malloc(size_t n) noexcept {
+  Profile::count(Profile::ALLOCATIONS);
+  return malloc(n ? n : 1);
+}
+static void* counted_new(size_t n) {
+  void* p = counted_malloc(n);
+  if (!p) throw bad_alloc();
+  return p;
+}
+__attribute__((noinline)) static void counted_free(void* p) noexcept {
+  free(p);
+}
+void* operator new(size_t n) { return counted_new(n); }
+void* operator new[](size_t n) { return counted_new(n); }
+void* operator new(size_t n, const nothrow_t&) noexcept {
+  return counted_malloc(n);
+}
+void* operator new[](size_t n, const nothrow_t&) noexcept {
+  return counted_malloc(n);
+}
+void operator delete(void* p) noexcept { counted_free(p); }
+void operator delete[](void* p) noexcept { counted_free(p); }
+void operator delete(void* p, size_t) noexcept { counted_free(p); }
+void operator delete[](void* p, size_t) noexcept { counted_free(p); }
+void operator delete(void* p, const nothrow_t&) noexcept { counted_free(p); }
+void operator delete[](void* p, const nothrow_t&) noexcept { counted_free(p); }
+#ifdef __cpp_aligned_new
+static void* counted_aligned(size_t n, align_val_t a) noexcept {
+  Profile::count(Profile::ALLOCATIONS);
+  void* p;
+  return posix_memalign(&p, max((size_t)a, sizeof(void*)), n ? n : 1) ? 0 : p;
+}
+void* operator new(size_t n, align_val_t a) {
+  void* p = counted_aligned(n, a);
+  if (!p) throw bad_alloc();
+  return p;
+}
+void* operator new[](size_t n, align_val_t a) {
+  return operator new(n, a);
+}
+void* operator new(size_t n, align_val_t a, const nothrow_t&) noexcept {
+  return counted_aligned(n, a);
+}
+void* operator new[](size_t n, align_val_t a, const nothrow_t&) noexcept {
+  return counted_aligned(n, a);
+}
+void operator delete(void* p, align_val_t) noexcept { counted_free(p); }
+void operator delete[](void* p, align_val_t) noexcept { counted_free(p); }
+void operator delete(void* p, size_t, align_val_t) noexcept { counted_free(p); }
+void operator delete[](void* p, size_t, align_val_t) noexcept { counted_free(p); }
+void operator delete(void* p, align_val_t, const nothrow_t&) noexcept {
+  counted_free(p);
+}
+void operator delete[](void* p, align_val_t, const nothrow_t&) noexcept {
+  counted_free(p);
+}
+#endif
+
+// the length of a trace file so far, which checkpoints save, or -1
+// if it isn't being written.
+static int64_t trace_length(ofstream& os) {
+  if (!os.is_open())
+    return -1;
+  os.flush();
+  return os.tellp();
+}
+
+// on resuming, cuts off what was written to the trace file after the
+// checkpoint, as it is about to be written again.
+static void cut_trace(ofstream& os, const string& file, int64_t length) {
+  if (!os.is_open() || length < 0)
+    return;
+  os.seekp(0, ios::end);
+  if (os.tellp() < length)
+    error(file + " is shorter than when the checkpoint was made");
+  if (truncate(file.c_str(), length))
+    error("couldn't truncate " + file);
+  os.seekp(0, ios::end);
+}
+
 int main(int argc, char* argv[])
 {
   //list the options that require arguments
-  ECArgs arguments(argc, argv, string("aAbUmuMiIqvreotwWT"));
+  ECArgs arguments(argc, argv, string("aAbUmuMiIqvreotwWTSLPKJ"));
   if (arguments.isset('h')) {
     cout << "Usage: segment [input_file]" << endl
+	 << "(input_file may be a corpus compiled with --compile-corpus)" << endl
+	 << "--compile-corpus[=<file>] (save the input in binary to file, default input_file.corpus, and stop)" << endl
+	 << "--synthetic=<N> (print a synthetic corpus of N utterances, with seed -r (default 0), and stop)" << endl
+	 << "\t --alphabet=<A> (number of letters.  Default = 26.)" << endl
+	 << "\t --lexicon=<V> (number of word types.  Default = 10000.)" << endl
+	 << "\t --word-length=<L> (mean letters per word.  Default = 3.5.)" << endl
+	 << "\t --utterance-length=<W> (mean words per utterance.  Default = 3.5.)" << endl
+	 << "\t --zipf=<s> (exponent of the Zipfian word distribution.  Default = 1.)" << endl
+	 << "--generate=<N> (after sampling, generate N utterances from the final state to output.generated)" << endl
+	 << "--checkpoint[=<file>] (save the sampler's state to file, default input_file.checkpoint, every 100 iters)" << endl
+	 << "--checkpoint-every=<N> (with --checkpoint, save every N iters instead)" << endl
+	 << "--resume[=<file>] (carry on from the state saved in file, default the --checkpoint file, exactly as if the run had not stopped; give the same options as before, but -P may change if -J is given)" << endl
+	 << "--progress[=<S>] (every S seconds, default 10, print the iteration, annealing stage, boundaries and utterances sampled per second, seconds per sweep and time left to stderr)" << endl
+	 << "--status=<file> (write the same report to file, replacing the last one, every --progress seconds)" << endl
+	 << "--profile[=<N>] (every N iters, default 10, and at the end, print the time spent in each phase, counts of hot events, CPU time and memory as a line of JSON to output.profile, or to stderr without -o)" << endl
 	 << "-l (print reference lexicon stats without running EM)" << endl
 	 << "-a <alpha0> (total unigram generator weight)" << endl
 	 << "-A <alpha1> (total bigram generator weight)" << endl
@@ -42,6 +148,14 @@ int main(int argc, char* argv[])
 	 << "\t M <mixing param> (proportion of noise in generator)" << endl
 	 << "-i <number of iterations>" << endl
 	 << "-I [utt|pho|ran|true|True] (type of init.  Default = random.)" << endl
+	 << "-S [single|block|type] (sampler.  Default = single.)" << endl
+	 << "\t single: Gibbs sampling of one boundary at a time" << endl
+	 << "\t block: resample whole utterances (unigram model only)" << endl
+	 << "\t type: resample all boundaries of a type at once (unigram model only)" << endl
+	 << "-L <N> (max word length for -S block.  Default = no limit.)" << endl
+	 << "-P <N> (sample with N threads, approximately; single sampler, unigram model only.  Default = 1, exact.)" << endl
+	 << "-K <N> (with -P, merge counts every N utterances per shard.  Default = once per iteration.)" << endl
+	 << "-J <N> (split the utterances into N shards for -P; the result depends on N but not on the number of threads.  Default = one per thread.)" << endl
       	 << "-e [samp|lmax|gmax] (type of evaluation)" << endl
 	 << "-o <output_filename_base>" << endl
 	 << "-q <Q> (print results summary every Q iters to stdout)" << endl
@@ -70,7 +184,95 @@ int main(int argc, char* argv[])
   else {
     filename = "test.in";
   }
+  // a corpus made up from scratch, with its words as the gold
+  // segmentation.
+  if (arguments.isset("synthetic")) {
+    Count n = strtol(arguments.value("synthetic").c_str(), NULL, 10);
+    Count alphabet_size = 26;
+    if (arguments.isset("alphabet"))
+      alphabet_size = strtol(arguments.value("alphabet").c_str(), NULL, 10);
+    Count lexicon_size = 10000;
+    if (arguments.isset("lexicon"))
+      lexicon_size = strtol(arguments.value("lexicon").c_str(), NULL, 10);
+    Float word_length = 3.5;
+    if (arguments.isset("word-length"))
+      word_length = strtod(arguments.value("word-length").c_str(), NULL);
+    Float utterance_length = 3.5;
+    if (arguments.isset("utterance-length"))
+      utterance_length = strtod(arguments.value("utterance-length").c_str(), NULL);
+    Float zipf = 1;
+    if (arguments.isset("zipf"))
+      zipf = strtod(arguments.value("zipf").c_str(), NULL);
+    uint64_t seed = 0;
+    if (arguments.isset('r'))
+      seed = strtol(arguments.value('r').c_str(), NULL, 10);
+    Generator generator(alphabet_size, lexicon_size, word_length,
+			utterance_length, zipf, seed);
+    generator.generate(n, cout);
+    exit(0);
+  }
+  // parse the corpus once, and save it for later runs to map.
+  if (arguments.isset("compile-corpus")) {
+    string compiled = arguments.value("compile-corpus");
+    if (compiled.empty())
+      compiled = filename + ".corpus";
+    if (Corpus::compiled(filename))
+      error(filename + " is already compiled");
+    Count nthreads = 1;
+    if (arguments.isset('P'))
+      nthreads = strtol(arguments.value('P').c_str(), NULL, 10);
+    try {
+      Datafile data(filename);
+      Corpus corpus;
+      data.load(corpus, nthreads);
+      corpus.add_types();
+      if (!corpus.save(compiled))
+	error("couldn't write " + compiled);
+      cout << "Compiled " << corpus.size() << " utterances into "
+	   << compiled << endl;
+    }
+    catch (FileError& e) {
+      cout << "Error: couldn't open input file " << filename << endl;
+    }
+    exit(0);
+  }
+  // checkpoints.  a checkpoint only fits a run with the same
+  // options, which are saved in it to be checked on resuming.  the
+  // number of threads (-P) is left out when -J fixes the shards, as
+  // it then doesn't change the result.
+  string checkpoint_file = filename + ".checkpoint";
+  if (arguments.isset("checkpoint") && !arguments.value("checkpoint").empty())
+    checkpoint_file = arguments.value("checkpoint");
+  Count checkpoint_freq = 0;
+  if (arguments.isset("checkpoint")) {
+    checkpoint_freq = 100;
+    if (arguments.isset("checkpoint-every"))
+      checkpoint_freq = strtol(arguments.value("checkpoint-every").c_str(),
+			       NULL, 10);
+  }
+  string resume_file;
+  if (arguments.isset("resume")) {
+    resume_file = arguments.value("resume");
+    if (resume_file.empty())
+      resume_file = checkpoint_file;
+  }
+  string options;
+  for (int k = 1; k < argc; k++) {
+    string arg = argv[k];
+    if (!arg.compare(0, 2, "-P") && arguments.isset('J')) {
+      if (arg.size() == 2)
+	k++;
+      continue;
+    }
+    if (arg.compare(0, 12, "--checkpoint") && arg.compare(0, 8, "--resume") &&
+	arg.compare(0, 9, "--profile") && arg.compare(0, 10, "--progress") &&
+	arg.compare(0, 8, "--status"))
+      options += arg + " ";
+  }
   // output files and printing frequencies
+  // (appended to when resuming, after cutting them back to the
+  // checkpoint)
+  ios::openmode mode = resume_file.empty() ? ios::out : ios::app;
   string file_base;
   ofstream words_os;
   if (arguments.isset('o')) 
@@ -85,7 +287,7 @@ int main(int argc, char* argv[])
       exit(0);
     }
     string file = file_base + ".stats";
-    stats_os.open(file.c_str());
+    stats_os.open(file.c_str(), mode);
     if (arguments.isset('t')) {
       print_stats = true;
       stats_freq = strtol(arguments.value('t').c_str(), NULL, 10);
@@ -99,6 +301,41 @@ int main(int argc, char* argv[])
       stats_freq = strtol(arguments.value('W').c_str(), NULL, 10);
     }
   }
+  Count profile_freq = 0;
+  ostream* profile_os = &cerr;
+  ofstream profile_file;
+  if (arguments.isset("profile")) {
+    profile_freq = 10;
+    if (!arguments.value("profile").empty())
+      profile_freq = strtol(arguments.value("profile").c_str(), NULL, 10);
+    if (file_base != "") {
+      string file = file_base + ".profile";
+      profile_file.open(file.c_str(), mode);
+      profile_os = &profile_file;
+    }
+    Profile::enable();
+  }
+  bool print_progress = arguments.isset("progress");
+  Float progress_interval = 0;
+  if (print_progress || arguments.isset("status")) {
+    progress_interval = 10;
+    if (print_progress && !arguments.value("progress").empty())
+      progress_interval = strtod(arguments.value("progress").c_str(), NULL);
+  }
+  string status_file;
+  if (arguments.isset("status"))
+    status_file = arguments.value("status");
+  Count ngenerate = 0;
+  ofstream generated_os;
+  if (arguments.isset("generate")) {
+    if (file_base == "") {
+      cerr << "option generate requires option o" << endl;
+      exit(0);
+    }
+    ngenerate = strtol(arguments.value("generate").c_str(), NULL, 10);
+    string file = file_base + ".generated";
+    generated_os.open(file.c_str());
+  }
   bool print_words = false;
   Count words_freq = 0;
   if (arguments.isset('w') || arguments.isset('W')) {
@@ -107,7 +344,7 @@ int main(int argc, char* argv[])
       exit(0);
     }
     string file = file_base + ".words";
-    words_os.open(file.c_str());
+    words_os.open(file.c_str(), mode);
     if (arguments.isset('w')) {
       print_words = true;
       words_freq = strtol(arguments.value('w').c_str(), NULL, 10);
@@ -131,8 +368,8 @@ int main(int argc, char* argv[])
       verbose_level = 0;
     }
   }
-  // The stl uses lrand48() if possible, otherwise
-  // rand(), so we need to seed the correct one.
+  // all our random numbers come from main_rng() and streams
+  // derived from the same seed (see Rng.h).
   //  string seed_type;
   int seed;
   if (arguments.isset('r')) {
@@ -141,9 +378,17 @@ int main(int argc, char* argv[])
   else {
     seed = time(0);
   }
-  srand(seed);
+  main_rng().seed(seed);
+  Checkpoint checkpoint;
   try {
-    DatafileBase* data = new Datafile(filename);
+    // reading the input, and building the state from it (or from a
+    // checkpoint).
+    Profile::switch_to(Profile::IO);
+    DatafileBase* data;
+    if (Corpus::compiled(filename))
+      data = new CompiledDatafile(filename);
+    else
+      data = new Datafile(filename);
     Scoring scoring;
     Float alpha = 20;
     Float alpha1 = 0;
@@ -183,7 +428,56 @@ int main(int argc, char* argv[])
     cout << "Boundary initialization: " << b_init << endl;
     Utterance::set_init(b_init);
     State::set_models(uni_model,bi_model,ngram,noise);
+    string sampler("single");
+    if (arguments.isset('S'))
+      sampler = arguments.value('S');
+    Count max_word_length = 0;
+    if (arguments.isset('L'))
+      max_word_length = strtol(arguments.value('L').c_str(), NULL, 10);
+    State::set_sampler(sampler, max_word_length);
+    Count nthreads = 1;
+    if (arguments.isset('P'))
+      nthreads = strtol(arguments.value('P').c_str(), NULL, 10);
+    Count sync_interval = 0;
+    if (arguments.isset('K'))
+      sync_interval = strtol(arguments.value('K').c_str(), NULL, 10);
+    Count nshards = 0;
+    if (arguments.isset('J'))
+      nshards = strtol(arguments.value('J').c_str(), NULL, 10);
+    State::set_threads(nthreads, sync_interval, nshards);
     State state(data, alpha, p_boundary, alpha1, p_utt_boundary);
+    //where the sampling loop is: the next iteration, and the
+    //annealing schedule's position.
+    Count start = 0;
+    Count temp_index = 0;
+    Float temp = 1;
+    if (!resume_file.empty()) {
+      if (!checkpoint.load(resume_file))
+	error("couldn't read checkpoint " + resume_file);
+      string saved;
+      checkpoint.get(saved);
+      if (saved != options)
+	error("the checkpoint " + resume_file + " was made with options " +
+	      saved + "not " + options);
+      checkpoint.get(seed);
+      checkpoint.get(start);
+      checkpoint.get(temp_index);
+      checkpoint.get(temp);
+      int64_t stats_length, words_length, profile_length;
+      checkpoint.get(stats_length);
+      checkpoint.get(words_length);
+      checkpoint.get(profile_length);
+      cut_trace(stats_os, file_base + ".stats", stats_length);
+      cut_trace(words_os, file_base + ".words", words_length);
+      cut_trace(profile_file, file_base + ".profile", profile_length);
+      state.restore(checkpoint);
+      if (!checkpoint.done())
+	error("the checkpoint " + resume_file + " is corrupt");
+      checkpoint.clear();
+      cerr << "Resuming from " << resume_file << " at iteration "
+	   << start << endl;
+    }
+    Profile::switch_to(Profile::OTHER);
 
     Count iters = 1000;
     if (arguments.isset('i'))
@@ -217,45 +511,66 @@ int main(int argc, char* argv[])
     Count temp_incr = 10;  //how many increments of temperature to get to T = 1
     if (iters && iters < temp_incr) temp_incr = iters;
     Count iter_incr = iters/temp_incr; //raise temp each iter_incr iters
-    Float temp;
     Fs temperatures;
     if (b_init == "True" || arguments.isset('T')) {
       anneal = false;
-      temp = 1;
       if (arguments.isset('T'))
 	temp = strtod(arguments.value('T').c_str(), NULL);
       cout << "Not doing annealing. T = " << temp << endl;
     }
     else {
-      temp = 0;
+      Float t = 0;
       for (Count i = 1; i <=temp_incr; i++) {
-	temp += 1.0/temp_incr;
-	temperatures.push_back(temp);
+	t += 1.0/temp_incr;
+	temperatures.push_back(t);
       }
       if (eval == "gmax") {// use additional iterations to anneal to 0
 	iters = 3*iters;
-	temp = 1;
+	t = 1;
 	for (Count i = 1; i <=temp_incr*2; i++) {
-	  temp *= 1.2;
-	  temperatures.push_back(temp);
+	  t *= 1.2;
+	  temperatures.push_back(t);
 	}
       }
       cout << "Raising temperature in " << temp_incr << " increments: " 
 	   << temperatures << endl;
     }
-    if (print_stats)
+    if (print_stats && resume_file.empty())
       state.print_stats_header(stats_os);
+    // the traces are formatted and written in the background.
+    TraceWriter writer(state.corpus(), stats_os, words_os);
+    Progress progress(print_progress ? &cerr : NULL, status_file,
+		      progress_interval, state.corpus(), start, iters);
+    Count nstages = anneal ? temperatures.size() : 0;
 
     //begin sampling loop
-    Count temp_index = 0;
-    for (Count i=0; i<iters; i++) {
-      if ((i%10) == 0) cerr << ".";
+    for (Count i=start; i<iters; i++) {
+      // the state is copied before the iteration, and written out
+      // while it runs.
+      if (checkpoint_freq && i > start && i % checkpoint_freq == 0) {
+	Profile::Timer timer(Profile::IO);
+	if (!checkpoint.wait())
+	  error("couldn't write checkpoint " + checkpoint_file);
+	checkpoint.put(options);
+	checkpoint.put(seed);
+	checkpoint.put(i);
+	checkpoint.put(temp_index);
+	checkpoint.put(temp);
+	writer.flush();
+	checkpoint.put(trace_length(stats_os));
+	checkpoint.put(trace_length(words_os));
+	checkpoint.put(trace_length(profile_file));
+	state.save(checkpoint);
+	checkpoint.save(checkpoint_file);
+      }
+      if ((i%10) == 0 && !print_progress) cerr << ".";
       if (anneal && ((i%iter_incr) == 0)){
 	temp = temperatures[temp_index++];
 	cerr << "iter " << i << ": temp = " << temp << endl;
       }
       if (print_freq && 
 	  ((i==100) || (i % print_freq == 0))) {
+	Profile::Timer timer(Profile::IO);
 	cerr << i << " p_cont=" << state.p_cont() 
 	     << " " << state.log_posterior() << endl;
 	cout << "Before iteration " << i << 
@@ -266,35 +581,36 @@ int main(int argc, char* argv[])
 	scoring.print_results();
 	scoring.reset();
       }
-      if (print_stats && (i % stats_freq == 0)) {
-	stats_os << i << ",\t";
-	state.print_stats(stats_os);
-      }
-      if (print_words && words_freq && (i % words_freq == 0)) {
-	words_os << state << endl;
-      }
+      bool trace_stats = print_stats && (i % stats_freq == 0);
+      bool trace_words = print_words && words_freq && (i % words_freq == 0);
       if (print_end && (i%words_freq == 0) &&
 	  (!anneal ||
-	   (temp == temperatures.back() && i%iter_incr >= iter_incr/2))) {
-	stats_os << i << ",\t";
-	state.print_stats(stats_os);
-	words_os << state << endl;
+	   (temp == temperatures.back() && i%iter_incr >= iter_incr/2)))
+	trace_stats = trace_words = true;
+      if (trace_stats || trace_words) {
+	Profile::Timer timer(Profile::IO);
+	writer.add(state, i, trace_stats, trace_words);
       }
       state.sample(temp);
+      if (profile_freq && (i+1) % profile_freq == 0)
+	Profile::report(*profile_os, i+1);
+      if (progress_interval)
+	progress.sweep(i+1, temp_index, nstages, temp);
     } //end of sampling loop
+    if (progress_interval)
+      progress.finish(iters, temp_index, nstages, temp);
 
+    if (checkpoint_freq && !checkpoint.wait())
+      error("couldn't write checkpoint " + checkpoint_file);
     if (eval == "lmax")
 	state.sample(10000); //like doing a local max instead of sample.
     //cout << state.get_lexicon() << endl;
 
     //print final stats
-    if (print_stats || print_end) {
-      stats_os << iters << ",\t";
-      state.print_stats(stats_os);
-    }
-    if (print_words || print_end) {
-      words_os << state;
-    }
+    Profile::switch_to(Profile::IO);
+    if (print_stats || print_end || print_words)
+      writer.add(state, iters, print_stats || print_end,
+		 print_words || print_end, true);
 
     state.score_utterances(scoring);
     if (verbose_level == 1 || verbose_level == 3) {
@@ -310,6 +626,9 @@ int main(int argc, char* argv[])
     else {
     cout << endl;
     cerr << iters << " iterations" << endl;
+    cerr << "p_word cache: " << State::p_word_cache_hits() << " hits, "
+	 << State::p_word_cache_misses() << " misses" << endl;
+    state.print_thread_stats(cerr);
     if (verbose_level == 2 || verbose_level == 3) {
       scoring.print_segmented_lexicon();
       cout << endl;
@@ -319,17 +638,16 @@ int main(int argc, char* argv[])
     cout << "p_cont=" << state.p_cont() 
 	 << ", log prob = " << state.log_posterior() << endl;
     }
-//     cout << "Generating utterances:" << endl;
-//     for (Count j = 0; j < 1000; j++) {
-//     state.generate();
-//     }
+    if (ngenerate)
+      state.generate(ngenerate, generated_os);
+    if (profile_freq) {
+      writer.finish();
+      Profile::report(*profile_os, iters);
+    }
     delete data;
   }
   catch (FileError& e) {
     cout << "Error: couldn't open input file " << filename << endl;
   }
-  catch (UtteranceLength& e) {
-    e.print();
-  }
 }
 
@@ -43,16 +43,7 @@ struct FFm : public std::vector<Fs> {
 
 typedef SGLexicon<string,Count> StringLexicon;
 class Lexicon;
+class LocalLexicon;
 class BiLexicon;
 
-struct Boundary {
-  bool yes; // word boundary?
-  Count table; // table number
-  Count final_table; // if this is an utt boundary,
-  // final_table will be the number of the table with the
-  // (last word, $) bigram.  Otherwise, = 0.
-  Boundary(bool w, Count t = 0, Count f = 0):
-    yes(w), table(t), final_table(f) {}
-};
-
 #endif
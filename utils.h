@@ -52,7 +52,12 @@
 #include <utility>
 #include <vector>
 #include <errno.h>
+#include <cstring>
+#ifdef __linux__
+#include <unistd.h>
+#endif
 #include <memory>
+#include "Rng.h"
 
 #define EXT_NAMESPACE __gnu_cxx
 
@@ -117,17 +122,36 @@ stringToLong(const std::string& str)
 #endif
 }
 
-//returns a random double between 0 and n, inclusive
+//the random stream of the main thread, seeded from -r.
+inline Rng& main_rng() {
+  static Rng rng;
+  return rng;
+}
+
+//the stream the current thread draws from.  worker threads point
+//this at the stream of the work they are doing; elsewhere it is
+//null and we use main_rng().
+inline Rng*& thread_rng_state() {
+  static thread_local Rng* rng = 0;
+  return rng;
+}
+
+inline Rng& thread_rng() {
+  Rng* rng = thread_rng_state();
+  return rng ? *rng : main_rng();
+}
+
+//returns a random double between 0 and n, not including n
 inline double randd (int n=1) 
-{return n * double(rand()) / RAND_MAX;}
+{return n * thread_rng().uniform();}
 
 //returns a random int between 0 and n-1, inclusive
 inline int randi (int n) 
-{return int(floor(n * double(rand()) / RAND_MAX));}
+{return int(n * thread_rng().uniform());}
 
 //returns a random int between n and m, inclusive
 inline int randi (int n, int m) 
-{return int(floor((m-n+1) * double(rand()) / RAND_MAX) + n);}
+{return int((m-n+1) * thread_rng().uniform()) + n;}
 
 //returns 2 random gaussians
 inline std::pair<double,double> rand_normals (double mean=0, double std=1) {
@@ -525,6 +549,17 @@ struct second_greaterthan {
   }
 };
 
+// largest second first, and smallest first among equal seconds, so
+// that a listing by count doesn't depend on the order of a hash table.
+struct second_greaterthan_first_lessthan {
+  template <typename T1, typename T2>
+  bool operator() (const T1& e1, const T2& e2) {
+    if (e1.second != e2.second)
+      return e1.second > e2.second;
+    return e1.first < e2.first;
+  }
+};
+
 struct string_shorterthan {
   bool operator() (const std::string& e1, const std::string& e2) {
     if (e1.length() != e2.length())
@@ -1063,33 +1098,55 @@ inline std::ostream& operator<< (std::ostream& os, const boost::shared_ptr<T>& s
 
 #endif  // BOOST_SHARED_PTR_HPP_INCLUDED
 
-struct resource_usage { };
+// the process's CPU time and memory, as of construction.  on linux
+// they are read from /proc/self; elsewhere they are all 0.
+struct resource_usage {
+  double utime;   // user CPU seconds
+  double stime;   // system CPU seconds
+  double vsize;   // Mb of virtual memory
+  double rss;     // Mb resident
+  double peak_rss; // Mb resident at most, so far
+  resource_usage(): utime(0), stime(0), vsize(0), rss(0), peak_rss(0) {
+#ifdef __linux__
+    FILE* fp = fopen("/proc/self/stat", "r");
+    if (fp) {
+      // the command name may have spaces in it, so skip to its end.
+      char buf[1024];
+      size_t n = fread(buf, 1, sizeof(buf)-1, fp);
+      buf[n] = 0;
+      const char* p = strrchr(buf, ')');
+      unsigned long ut, st, vs;
+      if (p && sscanf(p+1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u"
+		      " %lu %lu %*d %*d %*d %*d %*d %*d %*u %lu",
+		      &ut, &st, &vs) == 3) {
+	double ticks = sysconf(_SC_CLK_TCK);
+	utime = ut / ticks;
+	stime = st / ticks;
+	vsize = vs / 1048576.0;
+      }
+      fclose(fp);
+    }
+    fp = fopen("/proc/self/status", "r");
+    if (fp) {
+      char line[256];
+      unsigned long kb;
+      while (fgets(line, sizeof(line), fp)) {
+	if (sscanf(line, "VmRSS: %lu", &kb) == 1)
+	  rss = kb / 1024.0;
+	else if (sscanf(line, "VmHWM: %lu", &kb) == 1)
+	  peak_rss = kb / 1024.0;
+      }
+      fclose(fp);
+    }
+#endif
+  }
+};
 
-#ifndef __i386
-inline std::ostream& operator<< (std::ostream& os, resource_usage r)
-{
-  return os;
-}
-#else // Assume we are on a 586 linux
 inline std::ostream& operator<< (std::ostream& os, resource_usage r)
 {
-  FILE* fp = fopen("/proc/self/stat", "r");
-  assert(fp);
-  int utime;
-  int stime;
-  unsigned int vsize;
-  unsigned int rss;
-  int result = 
-    fscanf(fp, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %d %d %*d %*d %*d %*d"
-           "%*u %*u %*d %u %u", &utime, &stime, &vsize, &rss);
-  assert(result == 4);
-  fclose(fp);
-  // s << "utime = " << utime << ", stime = " << stime << ", vsize = " << vsize << ", rss = " << rss
-;
-  // return s << "utime = " << utime << ", vsize = " << vsize;
-  return os << "utime " << float(utime)/1.0e2 << "s, vsize " 
-	    << float(vsize)/1048576.0 << " Mb.";
+  return os << "utime " << r.utime << "s, stime " << r.stime << "s, vsize "
+	    << r.vsize << " Mb, rss " << r.rss << " Mb (peak " << r.peak_rss
+	    << " Mb).";
 }
-#endif
 
 #endif  // UTILITY_H